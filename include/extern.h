@@ -11,9 +11,13 @@
 
 /* === Variable types === */
 struct pingmode {
-	struct sockaddr to;
-	int sock_fp;
-	unsigned char *packet;
+	struct sockaddr_storage to;
+	int result;
+	int srtt;			/* Smoothed round trip time in usec, 0 = no sample yet. */
+	int rttvar;			/* Round trip time variation in usec. */
+	unsigned long long lost;	/* One bit per echo request sent, newest in bit 0, set if lost. */
+	int nsent;			/* Number of valid bits in 'lost'. */
+	unsigned short last_seq;	/* Sequence number of the newest request (bit 0). */
 };
 
 struct filemode {
@@ -22,10 +26,12 @@ struct filemode {
 
 struct ifmode {
 	unsigned long bytes;
+	int missing;			/* Not in /proc/net/dev last time, already reported. */
 };
 
 struct tempmode {
 	int	in_use;
+	int	fd;			/* Kept open while in use, see procfile.c. */
 	unsigned char have1, have2, have3;
 };
 
@@ -36,13 +42,166 @@ union wdog_options {
 	struct tempmode temp;
 };
 
+/* Log-bucketed histogram of 32-bit values (see histogram.c). */
+#define HIST_SUB_BITS	3
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+	unsigned long count;
+	unsigned long min;
+	unsigned long max;
+	unsigned long long sum;
+	unsigned int bucket[HIST_BUCKETS];
+};
+
+/* Keep-alive timing, see keep_alive_stats(). */
+struct ka_stats {
+	struct histogram spacing;	/* Time between successful refreshes in usec. */
+	unsigned long refreshes;
+	unsigned long near_miss;	/* Refreshes with less than NEAR_MISS_PCT of the time-out left. */
+	long min_margin;		/* Least time left at a refresh in msec, -1 if not known yet. */
+	long last_margin;		/* Time left at the latest refresh in msec, -1 if not known. */
+	int hw_timeleft;		/* TRUE if the margins were read with WDIOC_GETTIMELEFT. */
+};
+
+/*
+ * A configuration list entry. The entries of a list are kept in one array (see
+ * add_list()), with the fields used on every check first.
+ */
 struct list {
 	char *name;
-	int version;
+	struct list *next;
+	int interval;
+	int phase;
 	time_t last_time;
 	int repair_count;
+	int paused;			/* Skipped while set, by the control socket. */
+	int last_result;		/* Error code of the latest check. */
+	long last_latency;		/* Time taken by the latest check in usec. */
+	unsigned long checks;
+	unsigned long errors;		/* Checks with a result other than ENOERR. */
 	union wdog_options parameter;
-	struct list *next;
+	int version;
+	struct histogram *latency;	/* Time taken by each check of this entry in usec, kept apart. */
+};
+
+/* The lists read from the configuration file, as swapped out by reread_config(). */
+struct config_lists {
+	struct list *tr_bin;
+	struct list *file;
+	struct list *target;
+	struct list *pidfile;
+	struct list *iface;
+	struct list *temp;
+};
+
+/* Running counts of what the daemon has done, see cost.c. */
+struct cost {
+	unsigned long long syscalls;
+	unsigned long forks;
+};
+
+/* A /proc or /sys file kept open and read once per pass, see procfile.c. */
+struct proc_file {
+	const char *name;
+	char *buf;
+	size_t size;
+	int fd;
+	unsigned long pass;		/* Pass of the main loop 'buf' was read in, 0 for none. */
+	char *alloc;			/* 'buf' once grown past the one given, else NULL. */
+};
+
+#define PROC_FILE(fname, fbuf)	{ (fname), (fbuf), sizeof(fbuf), -1, 0, NULL }
+
+/* A local Unix socket server and its clients, see unix_server.c. */
+#define SERVER_IN_SIZE	1024
+
+struct unix_server;
+
+struct server_client {
+	struct unix_server *srv;
+	int fd;
+	int writing;
+	int want_out;			/* Registered for EPOLLOUT rather than EPOLLIN. */
+	time_t opened;
+	int pid, uid;			/* Of the peer, -1 unless the server is private. */
+	size_t len;
+	char in[SERVER_IN_SIZE];
+	const char *out;
+	size_t out_len;
+	size_t sent;
+};
+
+struct unix_server {
+	const char *what;		/* For messages, as in "control". */
+	int max_clients;
+	int private;			/* Only root and the daemon's user may connect. */
+	const char *denied;		/* Sent to a peer that is turned away, or NULL. */
+	int (*complete)(const char *in);		/* Has the whole request arrived? */
+	void (*respond)(struct server_client *c);	/* Set 'out' and 'out_len'. */
+	void (*release)(struct server_client *c);	/* Done with 'out', or NULL. */
+	int listen_fd;
+	char *name;			/* As bound, NULL while closed. */
+	struct server_client *clients;
+};
+
+/* Entry in the main loop's check schedule (see schedule.c). */
+struct sched_item {
+	struct timespec due;
+	int period;
+	int order;
+	int kind;
+	struct list *act;
+};
+
+/* The kind of check a schedule item runs. */
+enum {
+	CHECK_TICK = 0,		/* keep-alive, sync, file table, loop counting */
+	CHECK_LOAD,
+	CHECK_MEMORY,
+	CHECK_TEMP,
+	CHECK_FILE,
+	CHECK_PIDFILE,
+	CHECK_IFACE,
+	CHECK_PING,
+	CHECK_BINARY,
+	CHECK_TYPES		/* The number of kinds, see checks.c. */
+};
+
+/* Flags for a kind of check. */
+#define CHECK_POOLED	0x01	/* Only looks at its own entry, so can run on the worker pool. */
+#define CHECK_BATCHED	0x02	/* Entries due together are checked as one batch, by check_batch(). */
+
+/*
+ * A kind of check, as listed in the registry in checks.c. A kind either has a
+ * list of configured entries or is a single check (like the load average) with
+ * an entry of its own for the retry timer and counts. Any of the functions can
+ * be NULL if there is nothing for them to do.
+ */
+struct check_type {
+	const char *name;
+	const char *entry_name;		/* A single check's own entry. */
+	int flags;
+	struct list **list;		/* The configured entries, NULL for a single check. */
+	int *interval;			/* Its check period option, the main 'interval' if 0. */
+	int (*enabled)(void);		/* Is a single check configured? */
+	int (*valid)(struct list *list);	/* Returns -1 if the entries can't be checked. */
+	int (*open)(struct list *list);
+	int (*watch)(struct list *list);	/* Add its sockets to the event loop. */
+	int (*reopen)(struct list *old, struct list *list);	/* Move over to reloaded entries. */
+	int (*check)(struct list *act);
+	int (*check_batch)(struct list *act[], int res[], int num);
+	int (*close)(struct list *list);
+	void (*describe)(struct list *list);	/* Log the settings, 'list' is NULL if not configured. */
+
+	/* Kept by checks.c. */
+	struct list *entry;
+	struct list *opened;		/* The entries it was opened with. */
+	int is_open;
+	struct histogram latency;	/* Time taken by each check (or batch) in usec. */
+	unsigned long runs;
+	unsigned long failures;
 };
 
 /* === Constants === */
@@ -81,6 +240,15 @@ extern int pingcount;
 extern int temp_poweroff;
 extern int sigterm_delay;
 
+extern int load_interval;
+extern int memory_interval;
+extern int temp_interval;
+extern int file_interval;
+extern int pidfile_interval;
+extern int iface_interval;
+extern int ping_interval;
+extern int test_interval;
+
 extern char *devname;
 extern char *admin;
 
@@ -93,9 +261,26 @@ extern char *logdir;
 
 extern char *heartbeat;
 extern int hbstamps;
+extern int hb_binary;
 
 extern int realtime;
 
+extern int ka_thread_mode;
+extern int ka_stale;
+extern int ka_spacing;
+
+extern int ping_adaptive;
+extern int ping_min_rto;
+extern int ping_max_loss;
+extern int ping_max_rtt;
+extern int ping_window;
+
+extern int check_workers;
+extern int latency_interval;
+extern char *stats_file;
+extern char *metrics_socket;
+extern char *control_socket;
+
 extern struct list *tr_bin_list;
 extern struct list *file_list;
 extern struct list *target_list;
@@ -136,7 +321,15 @@ int check_file_table(void);
 int open_watchdog(char *name, int timeout);
 int set_watchdog_timeout(int timeout);
 int keep_alive(void);
+int keep_alive_deadline(struct timespec *when);
+int start_keepalive_thread(int stale, int priority);
+int stop_keepalive_thread(void);
+int reopen_heartbeat(void);
 int get_watchdog_fd(void);
+int get_watchdog_timeout(void);
+void keep_alive_spacing(struct histogram *h);
+void keep_alive_stats(struct ka_stats *st);
+void log_keep_alive_stats(void);
 int close_watchdog(void);
 void safe_sleep(int sec);
 
@@ -146,14 +339,20 @@ int check_load(void);
 int close_loadcheck(void);
 
 /** net.c **/
-int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *packet, int time, int count);
+int check_net(struct list *targets[], int num, int time, int count);
 int open_netcheck(struct list *tlist);
+int valid_targets(struct list *tlist);
+int reopen_netcheck(struct list *tlist);
+int watch_netcheck(struct list *tlist);
 int close_netcheck(struct list *tlist);
 
+/** ping_filter.c **/
+int attach_ping_filter(int fd, int family, unsigned short id, struct list *tlist);
+
 /** temp.c **/
 int open_tempcheck(struct list *tlist);
 int check_temp(struct list *act);
-int close_tempcheck(void);
+int close_tempcheck(struct list *tlist);
 
 /** test_binary.c **/
 int check_bin(char *, int, int);
@@ -164,6 +363,7 @@ int check_pidfile(struct list *);
 
 /** iface.c **/
 int check_iface(struct list *);
+int close_ifacecheck(void);
 
 /** memory.c **/
 int open_memcheck(void);
@@ -192,6 +392,9 @@ int wd_daemon(int nochdir, int noclose);
 
 /** configfile.c **/
 void read_config(char *configfile);
+int reread_config(char *configfile, struct config_lists *old);
+void revert_config(struct config_lists *old);
+void free_config_lists(struct config_lists *lists);
 void free_all_lists(void);
 
 /** send-email.c **/
@@ -214,6 +417,94 @@ void sigterm_handler(int arg);
 int exec_as_func(int flags, void *ptr);
 int run_func_as_child(int timeout, int (*funcptr)(int, void *), int code, void *ptr);
 
+/** event_loop.c **/
+typedef void (*event_func)(int fd, unsigned int events, void *ptr);
+int open_event_loop(void);
+int close_event_loop(void);
+int event_watch_children(event_func func);
+int event_add_fd(int fd, unsigned int events, event_func func, void *ptr);
+int event_del_fd(int fd);
+int event_wait(const struct timespec *deadline);
+void event_break(void);
+
+/** schedule.c **/
+void sched_start(void);
+void sched_add(int kind, struct list *act, int period, int phase);
+int sched_next(struct timespec *due);
+int sched_pop_due(const struct timespec *now, struct sched_item *item);
+int sched_requeue(struct sched_item *item, const struct timespec *now);
+void sched_defer(const struct sched_item *item);
+int sched_run_now(int kind, const struct list *act);
+void sched_free(void);
+
+/** worker_pool.c **/
+typedef void (*work_func)(void *ptr);
+int open_workers(int num);
+void workers_submit(work_func func, void *ptr);
+void workers_wait(void);
+int close_workers(void);
+
+/** stats.c **/
+int open_stats(void);
+void update_stats(unsigned long loop_us);
+const struct ws_header *stats_snapshot(void);
+int close_stats(void);
+
+/** metrics.c **/
+int open_metrics(const struct histogram *loop);
+void metrics_check_failed(int err);
+void metrics_repair(int result);
+int close_metrics(void);
+
+/** unix_server.c **/
+int server_open(struct unix_server *srv, const char *name);
+int server_close(struct unix_server *srv);
+
+/** control.c **/
+typedef void (*control_func)(const char *cmd, const char *arg);
+int open_control(control_func func);
+void control_reply(const char *fmt, ...) PRINTF_STYLE(1, 2);
+int close_control(void);
+
+/** histogram.c **/
+void hist_clear(struct histogram *h);
+void hist_add(struct histogram *h, unsigned long val);
+unsigned long hist_percentile(const struct histogram *h, int pct);
+unsigned long hist_count_below(const struct histogram *h, unsigned long val);
+void hist_write(FILE *fp, const char *name, const struct histogram *h);
+
+/** checks.c **/
+extern struct check_type check_types[CHECK_TYPES];
+void init_checks(void);
+int check_enabled(int kind);
+struct list *check_entries(int kind);
+int check_period(int kind, const struct list *act);
+int valid_checks(void);
+void open_checks(void);
+int watch_checks(void);
+void reopen_checks(void);
+void close_checks(void);
+void describe_checks(void);
+int time_check(int kind, struct list *act, long *took);
+void account_check(int kind, struct list *act, int result, long took);
+void account_batch(int kind, struct list *act[], const int res[], int num, long took);
+
+/** cost.c **/
+int open_cost(void);
+const char *cost_source(void);
+int read_cost(struct cost *cost);
+int close_cost(void);
+
+/** procfile.c **/
+void proc_next_pass(void);
+int proc_pread(int fd, const char *name, char *buf, size_t size);
+int proc_read_once(const char *name, char *buf, size_t size);
+int proc_open(struct proc_file *pf);
+int proc_read(struct proc_file *pf, const char **data);
+int proc_close(struct proc_file *pf);
+int proc_columns(const char *str, int skip, long vals[], int num);
+int proc_keys(const char *str, const char *const keys[], long vals[], int num);
+
 /** reopenstd.c **/
 #define FLAG_REOPEN_STD_TEST	0x02
 #define FLAG_REOPEN_STD_REPAIR	0x04
@@ -0,0 +1,45 @@
+/* > heartbeat.h
+ *
+ * Layout of the binary heartbeat file, shared by the daemon and wd_heartbeat.
+ * All values are in host byte order.
+ *
+ * The file is a header followed by 'nslots' fixed size slots used as a ring.
+ * Each beat writes exactly one slot, and the slots are sized so none straddles
+ * a cache line. The header is only rewritten when the daemon opens or closes
+ * the file, so readers of a live file find the newest beat as the slot with the
+ * highest sequence number rather than from 'write_index'.
+ *
+ */
+
+#ifndef _HEARTBEAT_H
+#define _HEARTBEAT_H
+
+#include <stdint.h>
+
+#define HB_MAGIC	0x42485744	/* "DWHB" read as a little-endian word. */
+#define HB_VERSION	1
+
+/* One 64 byte cache line. */
+struct hb_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;		/* sizeof(struct hb_header) */
+	uint32_t slot_size;		/* sizeof(struct hb_slot) */
+	uint32_t nslots;
+	uint64_t write_index;		/* Beats written up to the last open or close. */
+	uint32_t generation;		/* Incremented each time the daemon opens the file. */
+	uint32_t reserved;
+	uint8_t boot_id[16];		/* Kernel boot id at the last open, zero if unknown. */
+	uint8_t pad[16];
+};
+
+/* 32 bytes, two to a cache line. */
+struct hb_slot {
+	uint64_t seq;			/* Beat number counting from 1, 0 while empty or being written. */
+	int64_t sec;			/* CLOCK_REALTIME of the beat. */
+	uint32_t nsec;
+	uint32_t generation;		/* Header generation the beat was written in. */
+	uint32_t reserved[2];
+};
+
+#endif /* _HEARTBEAT_H */
@@ -16,6 +16,7 @@ typedef enum {
 } string_read_e;
 
 /** read-conf.c **/
+void read_location(const char *fname, int line);
 void trim_white(char *buf);
 char *str_start(char *p);
 
@@ -26,6 +27,9 @@ int read_enumerated_func(char *arg, char *val, const char *name, const read_list
 int read_list_func(char *arg, char *val, const char *name, int version, struct list **list);
 
 void add_list(struct list **list, const char *name, int version);
+int list_count(const struct list *list);
+struct list *list_tail(struct list *list);
 void free_list(struct list **list);
+int same_list(const struct list *a, const struct list *b);
 
 #endif /*READ_CONF_H*/
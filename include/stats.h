@@ -0,0 +1,64 @@
+/* > stats.h
+ *
+ * Layout of the live statistics segment, shared by the daemon and wd_stat.
+ * All values are in host byte order.
+ *
+ * The segment is a header followed by 'nentries' fixed size entries, one for
+ * each configured check. The daemon rewrites it after every pass of its main
+ * loop under a sequence lock: 'seq' is odd while an update is in progress, so a
+ * reader copies what it needs and retries if 'seq' was odd or has changed. The
+ * daemon never waits for a reader.
+ *
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+#define WS_MAGIC	0x54535744	/* "DWST" read as a little-endian word. */
+#define WS_VERSION	1
+
+#define WS_NAME_LEN	96
+#define WS_KIND_LEN	16
+
+struct ws_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;		/* sizeof(struct ws_header) */
+	uint32_t entry_size;		/* sizeof(struct ws_entry) */
+	uint32_t nentries;
+	uint32_t seq;			/* Sequence lock, odd while being written. */
+	int32_t pid;
+	int64_t started;		/* CLOCK_REALTIME seconds the daemon started. */
+	int64_t updated;		/* CLOCK_REALTIME seconds of the last update. */
+	uint64_t loops;			/* Passes of the main loop. */
+	uint32_t last_loop_us;		/* Time the last pass took. */
+	uint32_t max_loop_us;
+	int32_t interval;		/* Main loop 'interval' in seconds. */
+	int32_t timeout;		/* Hardware time-out in seconds, 0 with no device. */
+	uint64_t refreshes;		/* Refreshes of the watchdog device. */
+	uint64_t near_miss;
+	int32_t min_margin_ms;		/* Least time left on the timer at a refresh, -1 if unknown. */
+	int32_t last_margin_ms;		/* Time left at the latest refresh, -1 if unknown. */
+	uint32_t hw_timeleft;		/* Non-zero if the margins come from the driver. */
+	uint32_t reserved;
+};
+
+struct ws_entry {
+	char name[WS_NAME_LEN];		/* Truncated if need be, always terminated. */
+	char kind[WS_KIND_LEN];		/* "ping", "file", ... */
+	int32_t last_result;		/* Error code of the last check, 0 = fine. */
+	uint32_t last_latency_us;
+	uint32_t max_latency_us;
+	int32_t repair_count;
+	uint64_t checks;
+	uint64_t errors;		/* Checks with a result other than 0. */
+	int64_t last_time;		/* CLOCK_MONOTONIC seconds the retry timer started, 0 if not running. */
+	int32_t rtt_us;			/* Ping smoothed round trip time, -1 for other checks or no sample. */
+	int32_t rttvar_us;
+	uint32_t lost;			/* Pings lost out of the last 'sent'. */
+	uint32_t sent;
+};
+
+#endif /* _STATS_H */
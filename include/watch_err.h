@@ -17,5 +17,7 @@
 #define ETOOLONG	247	/* child didn't return in time */
 #define EUSERVALUE	246	/* reserved for user error code */
 #define EDONTKNOW	245	/* unknown, not "no error" (i.e. success) but implies test still running */
+#define EPINGLOSS	244	/* too many pings lost */
+#define ESLOWPING	243	/* ping round trip time too long */
 
 #endif /*_WATCH_ERR_H*/
@@ -0,0 +1,584 @@
+/* > checks.c
+ *
+ * The registry of the kinds of check the daemon can run, indexed by CHECK_*.
+ * Each kind says how to open, run, reopen (after a reload), close and describe
+ * itself, and the main loop, shut-down, statistics and logging all work from
+ * this table. A new kind of check only needs a CHECK_* value and an entry here.
+ *
+ * Every check is timed and its result counted the same way, by account_check()
+ * (or account_batch() for a batch of them), both for its kind as a whole and for
+ * the list entry it was for.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>		/* For EXEC_PAGESIZE */
+
+#include "extern.h"
+#include "watch_err.h"
+#include "read-conf.h"		/* For add_list() */
+
+static int opened_maxtemp = 0;
+
+/* ============================================================================ */
+
+static int load_enabled(void)
+{
+	return (maxload1 || maxload5 || maxload15);
+}
+
+static int load_open(struct list *list)
+{
+	return open_loadcheck();
+}
+
+static int load_check(struct list *act)
+{
+	return check_load();
+}
+
+static int load_close(struct list *list)
+{
+	return close_loadcheck();
+}
+
+/* ============================================================================ */
+
+static int memory_enabled(void)
+{
+	return (minpages || minalloc);
+}
+
+static int memory_open(struct list *list)
+{
+	return open_memcheck();
+}
+
+static int memory_check(struct list *act)
+{
+	int res = check_memory();
+
+	return (res != ENOERR) ? res : check_allocatable();
+}
+
+static int memory_close(struct list *list)
+{
+	return close_memcheck();
+}
+
+static void memory_describe(struct list *list)
+{
+	if (list == NULL) {
+		log_message(LOG_INFO, "memory not checked");
+		return;
+	}
+
+	log_message(LOG_INFO, "memory: minimum pages = %d free, %d allocatable (%d byte pages)",
+		    minpages, minalloc, EXEC_PAGESIZE);
+}
+
+/* ============================================================================ */
+
+static int temp_open(struct list *list)
+{
+	opened_maxtemp = maxtemp;
+	return open_tempcheck(list);
+}
+
+static int temp_reopen(struct list *old, struct list *list)
+{
+	/* The sensors keep their warning levels unless something changed. */
+	if (same_list(old, list) && maxtemp == opened_maxtemp)
+		return 0;
+
+	close_tempcheck(old);
+	return temp_open(list);
+}
+
+static int temp_close(struct list *list)
+{
+	return close_tempcheck(list);
+}
+
+static void temp_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL) {
+		log_message(LOG_INFO, "temperature: no sensors to check");
+		return;
+	}
+
+	log_message(LOG_INFO, "temperature: maximum = %d", maxtemp);
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "temperature: %s", act->name);
+}
+
+/* ============================================================================ */
+
+static void file_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL)
+		log_message(LOG_INFO, "file: no file to check");
+
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "file: %s:%d", act->name, act->parameter.file.mtime);
+}
+
+static void pidfile_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL)
+		log_message(LOG_INFO, "pidfile: no server process to check");
+
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "pidfile: %s", act->name);
+}
+
+static int iface_close(struct list *list)
+{
+	return close_ifacecheck();
+}
+
+static void iface_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL)
+		log_message(LOG_INFO, "interface: no interface to check");
+
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "interface: %s", act->name);
+}
+
+/* ============================================================================ */
+
+static int ping_reopen(struct list *old, struct list *list)
+{
+	return reopen_netcheck(list);
+}
+
+static int ping_batch(struct list *act[], int res[], int num)
+{
+	int ii, rv;
+
+	/* in ping mode ping the ip addresses */
+	rv = check_net(act, num, tint, pingcount);
+
+	for (ii = 0; ii < num; ii++)
+		res[ii] = act[ii]->parameter.net.result;
+
+	return rv;
+}
+
+static void ping_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL) {
+		log_message(LOG_INFO, "ping: no machine to check");
+		return;
+	}
+
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "ping: %s", act->name);
+
+	if (ping_adaptive)
+		log_message(LOG_INFO, "ping: adaptive time-out, minimum %dms", ping_min_rto);
+	if (ping_max_loss > 0)
+		log_message(LOG_INFO, "ping: maximum loss %d%% of last %d", ping_max_loss, ping_window);
+	if (ping_max_rtt > 0)
+		log_message(LOG_INFO, "ping: maximum round trip time %dms", ping_max_rtt);
+}
+
+/* ============================================================================ */
+
+static int binary_check(struct list *act)
+{
+	/* test, or test/repair binaries in the watchdog.d directory */
+	return check_bin(act->name, test_timeout, act->version);
+}
+
+static int binary_close(struct list *list)
+{
+	free_process();		/* What check_bin() was waiting to report. */
+	return 0;
+}
+
+static void binary_describe(struct list *list)
+{
+	struct list *act;
+
+	if (list == NULL) {
+		log_message(LOG_INFO, "no test binary files");
+		return;
+	}
+
+	log_message(LOG_INFO, "test binary time-out = %d", test_timeout);
+	for (act = list; act != NULL; act = act->next)
+		log_message(LOG_INFO, "%s: %s", act->version == 0 ? "test binary V0" : "test/repair V1", act->name);
+}
+
+/* ============================================================================ */
+
+struct check_type check_types[CHECK_TYPES] = {
+	[CHECK_TICK] = {
+		.name = "tick",
+	},
+	[CHECK_LOAD] = {
+		.name = "load",
+		.entry_name = "<load-average>",
+		.interval = &load_interval,
+		.enabled = load_enabled,
+		.open = load_open,
+		.check = load_check,
+		.close = load_close,
+	},
+	[CHECK_MEMORY] = {
+		.name = "memory",
+		.entry_name = "<free-memory>",
+		.interval = &memory_interval,
+		.enabled = memory_enabled,
+		.open = memory_open,
+		.check = memory_check,
+		.close = memory_close,
+		.describe = memory_describe,
+	},
+	[CHECK_TEMP] = {
+		.name = "temperature",
+		.flags = CHECK_POOLED,
+		.list = &temp_list,
+		.interval = &temp_interval,
+		.open = temp_open,
+		.reopen = temp_reopen,
+		.check = check_temp,
+		.close = temp_close,
+		.describe = temp_describe,
+	},
+	[CHECK_FILE] = {
+		.name = "file",
+		.flags = CHECK_POOLED,
+		.list = &file_list,
+		.interval = &file_interval,
+		.check = check_file_stat_safe,
+		.describe = file_describe,
+	},
+	[CHECK_PIDFILE] = {
+		.name = "pidfile",
+		.flags = CHECK_POOLED,
+		.list = &pidfile_list,
+		.interval = &pidfile_interval,
+		.check = check_pidfile,
+		.describe = pidfile_describe,
+	},
+	[CHECK_IFACE] = {
+		.name = "interface",
+		.flags = CHECK_POOLED,
+		.list = &iface_list,
+		.interval = &iface_interval,
+		.check = check_iface,
+		.close = iface_close,
+		.describe = iface_describe,
+	},
+	[CHECK_PING] = {
+		.name = "ping",
+		.flags = CHECK_BATCHED,
+		.list = &target_list,
+		.interval = &ping_interval,
+		.valid = valid_targets,
+		.open = open_netcheck,
+		.watch = watch_netcheck,
+		.reopen = ping_reopen,
+		.check_batch = ping_batch,
+		.close = close_netcheck,
+		.describe = ping_describe,
+	},
+	[CHECK_BINARY] = {
+		.name = "test-binary",
+		.list = &tr_bin_list,
+		.interval = &test_interval,
+		.check = binary_check,
+		.close = binary_close,
+		.describe = binary_describe,
+	},
+};
+
+/* ============================================================================ */
+
+/*
+ * Make the entries of the single checks, once at start-up.
+ */
+
+void init_checks(void)
+{
+	int kind;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		struct check_type *type = &check_types[kind];
+
+		if (type->entry_name != NULL && type->entry == NULL)
+			add_list(&type->entry, type->entry_name, 0);
+	}
+}
+
+/*
+ * Is this kind of check configured at all?
+ */
+
+int check_enabled(int kind)
+{
+	const struct check_type *type = &check_types[kind];
+
+	if (type->list != NULL)
+		return (*type->list != NULL);
+
+	if (type->enabled != NULL)
+		return (*type->enabled) ();
+
+	return FALSE;
+}
+
+/*
+ * The entries to schedule for this kind: the configured list, a single check's
+ * own entry, or NULL if it is not configured.
+ */
+
+struct list *check_entries(int kind)
+{
+	const struct check_type *type = &check_types[kind];
+
+	if (!check_enabled(kind))
+		return NULL;
+
+	return (type->list != NULL) ? *type->list : type->entry;
+}
+
+/*
+ * Pick the period for a check: the entry's own 'check-interval' if given, else
+ * the value for its kind, else the main loop 'interval'.
+ */
+
+int check_period(int kind, const struct list *act)
+{
+	const struct check_type *type = &check_types[kind];
+
+	if (act != NULL && act->interval > 0)
+		return act->interval;
+
+	if (type->interval != NULL && *type->interval > 0)
+		return *type->interval;
+
+	return tint;
+}
+
+/*
+ * Check every configured entry could be checked, before the daemon starts or a
+ * reload is taken up. Returns -1 if any can't.
+ */
+
+int valid_checks(void)
+{
+	int kind, rv = 0;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		const struct check_type *type = &check_types[kind];
+
+		if (type->valid != NULL && check_enabled(kind) && (*type->valid) (check_entries(kind)) < 0)
+			rv = -1;
+	}
+
+	return rv;
+}
+
+/*
+ * Open whatever each configured kind of check needs.
+ */
+
+void open_checks(void)
+{
+	int kind;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		struct check_type *type = &check_types[kind];
+
+		type->is_open = check_enabled(kind);
+		type->opened = check_entries(kind);
+
+		if (type->is_open && type->open != NULL)
+			(*type->open) (type->opened);
+	}
+}
+
+/*
+ * Have the checks that wait on sockets served by the event loop.
+ */
+
+int watch_checks(void)
+{
+	int kind, err = 0;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		const struct check_type *type = &check_types[kind];
+
+		if (type->is_open && type->watch != NULL)
+			err |= (*type->watch) (type->opened);
+	}
+
+	return err;
+}
+
+/*
+ * Move the checks over to the configuration just read, while the old lists are
+ * still there to compare with. A kind that can reopen itself decides what needs
+ * doing, others are closed and opened again if their entries changed.
+ */
+
+void reopen_checks(void)
+{
+	int kind;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		struct check_type *type = &check_types[kind];
+		struct list *list = check_entries(kind);
+		int on = check_enabled(kind);
+
+		if (type->reopen != NULL) {
+			if (on || type->is_open)
+				(*type->reopen) (type->opened, list);
+		} else if (on != type->is_open || !same_list(type->opened, list) || type->list == NULL) {
+			/* A single check has no entries to go by, but is cheap to open. */
+			if (type->is_open && type->close != NULL)
+				(*type->close) (type->opened);
+			if (on && type->open != NULL)
+				(*type->open) (list);
+		}
+
+		type->is_open = on;
+		type->opened = list;
+	}
+}
+
+/*
+ * Close every kind of check, and free the single checks' entries.
+ */
+
+void close_checks(void)
+{
+	int kind;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		struct check_type *type = &check_types[kind];
+
+		if (type->close != NULL)
+			(*type->close) (type->opened);
+
+		type->is_open = FALSE;
+		type->opened = NULL;
+		free_list(&type->entry);
+	}
+}
+
+/*
+ * Log the settings of each kind of check, given its entries (NULL if it is not
+ * configured).
+ */
+
+void describe_checks(void)
+{
+	int kind;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		const struct check_type *type = &check_types[kind];
+
+		if (type->describe != NULL)
+			(*type->describe) (check_entries(kind));
+	}
+}
+
+/*
+ * Run one check of 'act' and return its result, with the time it took in usec
+ * in 'took'. Safe to call from a worker, as nothing is recorded.
+ */
+
+int time_check(int kind, struct list *act, long *took)
+{
+	const struct check_type *type = &check_types[kind];
+	struct timespec start, now;
+	int res = ENOERR;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (type->check != NULL) {
+		res = (*type->check) (act);
+	} else if (type->check_batch != NULL) {
+		/* A batch of one, for when it can't join the others. */
+		struct list *one[1];
+
+		one[0] = act;
+		(*type->check_batch) (one, &res, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	*took = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000L;
+	return res;
+}
+
+static void account_entry(struct list *act, int result, long took)
+{
+	hist_add(act->latency, took);
+	act->last_latency = took;
+	act->last_result = result;
+	act->checks++;
+	if (result != ENOERR)
+		act->errors++;
+}
+
+/*
+ * Count a check of 'act' (NULL for none) that gave 'result' and took 'took' usec.
+ */
+
+void account_check(int kind, struct list *act, int result, long took)
+{
+	struct check_type *type = &check_types[kind];
+
+	if (took < 0)
+		took = 0;
+
+	hist_add(&type->latency, took);
+	type->runs++;
+	if (result != ENOERR)
+		type->failures++;
+
+	if (act != NULL)
+		account_entry(act, result, took);
+}
+
+/*
+ * Count a batch of 'num' checks that were made together, each entry being given
+ * the time the whole batch took.
+ */
+
+void account_batch(int kind, struct list *act[], const int res[], int num, long took)
+{
+	struct check_type *type = &check_types[kind];
+	int ii;
+
+	if (took < 0)
+		took = 0;
+
+	hist_add(&type->latency, took);
+	for (ii = 0; ii < num; ii++) {
+		type->runs++;
+		if (res[ii] != ENOERR)
+			type->failures++;
+		account_entry(act[ii], res[ii], took);
+	}
+}
@@ -25,9 +25,12 @@
 
 static void add_test_binaries(const char *path);
 static int check_RTC_time(void);
+static void parse_include(const char *from, const char *name, int depth);
 
 #define MAX_TIME	100000
 #define MAX_LOAD	2000
+#define MAX_INCLUDE	8	/* Nesting limit for 'include'. */
+#define READ_CHUNK	16	/* Growth of the list of files read, see first_read(). */
 
 /* The following list creates a 'name' along with checking options:
  *
@@ -69,6 +72,7 @@ static int check_RTC_time(void);
 #define TESTTIMEOUT		"test-timeout",0,MAX_TIME
 #define HEARTBEAT		"heartbeat-file",Read_allow_blank
 #define HBSTAMPS		"heartbeat-stamps",10,500
+#define HBFORMAT		"heartbeat-format",Heartbeat_format_list
 #define LOGDIR			"log-dir",Read_string_only
 #define TESTDIR			"test-directory",Read_allow_blank
 #define TEMPPOWEROFF	"temperature-poweroff",Yes_No_list
@@ -76,6 +80,30 @@ static int check_RTC_time(void);
 #define REPAIRMAX		"repair-maximum",0,100
 #define VERBOSE			"verbose",Yes_No_list
 #define SIGTERM_DELAY	"sigterm-delay",2,300
+#define CHECKINTERVAL	"check-interval",1,MAX_TIME	/* Applies to the most recent list entry. */
+#define CHECKPHASE		"check-phase",0,MAX_TIME
+#define LOADINTERVAL	"load-interval",0,MAX_TIME	/* Per-type defaults, 0 = use 'interval'. */
+#define MEMINTERVAL		"memory-interval",0,MAX_TIME
+#define TEMPINTERVAL	"temperature-interval",0,MAX_TIME
+#define FILEINTERVAL	"file-interval",0,MAX_TIME
+#define PIDINTERVAL		"pidfile-interval",0,MAX_TIME
+#define IFINTERVAL		"interface-interval",0,MAX_TIME
+#define PINGINTERVAL	"ping-interval",0,MAX_TIME
+#define TESTINTERVAL	"test-interval",0,MAX_TIME
+#define KATHREAD		"keepalive-thread",Yes_No_list
+#define KASTALE			"keepalive-stale",0,MAX_TIME
+#define KASPACING		"keepalive-spacing",0,MAX_TIME*1000	/* In milliseconds. */
+#define PINGADAPT		"ping-adaptive",Yes_No_list
+#define PINGMINRTO		"ping-min-timeout",1,MAX_TIME*1000	/* In milliseconds. */
+#define PINGMAXLOSS		"ping-max-loss",0,100
+#define PINGMAXRTT		"ping-max-rtt",0,MAX_TIME*1000
+#define PINGWINDOW		"ping-loss-window",1,64
+#define CHECKWORKERS	"check-workers",0,16
+#define LATENCYINT		"latency-interval",0,MAX_TIME
+#define STATSFILE		"stats-file",Read_allow_blank
+#define METRICSSOCKET	"metrics-socket",Read_allow_blank
+#define CONTROLSOCKET	"control-socket",Read_allow_blank
+#define INCLUDE			"include"
 
 #ifndef TESTBIN_PATH
 #define TESTBIN_PATH	NULL
@@ -99,6 +127,16 @@ int temp_poweroff = TRUE;
 int sigterm_delay = 5;	/* Seconds from first SIGTERM to sending SIGKILL during shutdown. */
 int repair_max = 1; /* Number of repair attempts without success. */
 
+/* Check periods by type in seconds, zero means use 'tint'. */
+int load_interval = 0;
+int memory_interval = 0;
+int temp_interval = 0;
+int file_interval = 0;
+int pidfile_interval = 0;
+int iface_interval = 0;
+int ping_interval = 0;
+int test_interval = 0;
+
 char *devname = NULL;
 char *admin = "root";
 
@@ -111,9 +149,26 @@ char *logdir = "/var/log/watchdog";
 
 char *heartbeat = NULL;
 int hbstamps = 300;
+int hb_binary = FALSE;
 
 int realtime = FALSE;
 
+int ka_thread_mode = FALSE;	/* Refresh the device from its own thread. */
+int ka_stale = 0;			/* Seconds without checker progress before it stops, 0 = watchdog-timeout. */
+int ka_spacing = 500;		/* Minimum milliseconds between device refreshes. */
+
+int ping_adaptive = FALSE;	/* Wait on each ping for a time based on the target's RTT. */
+int ping_min_rto = 200;		/* Shortest adaptive wait in milliseconds. */
+int ping_max_loss = 0;		/* Percentage of pings lost before failing, 0 = not checked. */
+int ping_max_rtt = 0;		/* Smoothed RTT limit in milliseconds, 0 = not checked. */
+int ping_window = 16;		/* Number of recent pings the loss is calculated over. */
+
+int check_workers = 0;		/* Threads running independent checks together, 0 = run in turn. */
+int latency_interval = 0;	/* Seconds between writing the latency histograms, 0 = only on SIGUSR1. */
+char *stats_file = NULL;	/* Live statistics for wd_stat, normally under /dev/shm. */
+char *metrics_socket = NULL;	/* Unix socket serving Prometheus metrics. */
+char *control_socket = NULL;	/* Unix socket for runtime commands. */
+
 /* Self-repairing binaries list */
 struct list *tr_bin_list = NULL;
 struct list *file_list = NULL;
@@ -136,6 +191,13 @@ READ_LIST_ADD("yes", 1)
 READ_LIST_END()
 };
 
+/* Formats for the heartbeat-file. */
+static const read_list_t Heartbeat_format_list[] = {
+READ_LIST_ADD("ascii", 0)
+READ_LIST_ADD("binary", 1)
+READ_LIST_END()
+};
+
 /* Use the #define macros to simplify the parsing function. Here "name" includes limits, options, etc. */
 #define READ_INT(name, iv)		read_int_func(		 arg, val, name, iv)
 #define READ_STRING(name, str)	read_string_func(	 arg, val, name, str)
@@ -143,25 +205,129 @@ READ_LIST_END()
 #define READ_LIST(name, list)	read_list_func(		 arg, val, name, 0, list)
 
 /*
- * Open the configuration file, read & parse it, and set the global configuration variables to those values.
+ * Every option variable, so a reload can start again from the defaults and put
+ * the running values back if the new settings are not taken up. The 'verbose'
+ * option is left out as it is also set from the command line.
  */
 
-void read_config(char *configfile)
+static int *const int_options[] = {
+	&tint, &logtick, &schedprio, &maxload1, &maxload5, &maxload15, &minpages, &minalloc,
+	&maxtemp, &pingcount, &temp_poweroff, &sigterm_delay, &repair_max,
+	&load_interval, &memory_interval, &temp_interval, &file_interval,
+	&pidfile_interval, &iface_interval, &ping_interval, &test_interval,
+	&test_timeout, &repair_timeout, &dev_timeout, &retry_timeout,
+	&hbstamps, &hb_binary, &realtime, &ka_thread_mode, &ka_stale, &ka_spacing,
+	&ping_adaptive, &ping_min_rto, &ping_max_loss, &ping_max_rtt, &ping_window,
+	&check_workers, &latency_interval
+};
+
+static char **const string_options[] = {
+	&devname, &admin, &logdir, &heartbeat, &repair_bin, &test_dir,
+	&stats_file, &metrics_socket, &control_socket
+};
+
+#define NUM_INT_OPTIONS		(int)(sizeof(int_options) / sizeof(int_options[0]))
+#define NUM_STRING_OPTIONS	(int)(sizeof(string_options) / sizeof(string_options[0]))
+
+struct option_values {
+	int iv[NUM_INT_OPTIONS];
+	char *str[NUM_STRING_OPTIONS];
+};
+
+static struct option_values defaults;	/* As compiled in, saved by the first read_config(). */
+static struct option_values running;	/* As before reread_config(), for revert_config(). */
+static int have_defaults = FALSE;
+
+/*
+ * Options only taken up as the daemon starts. A reload keeps their running values.
+ */
+
+static const struct {
+	const char *name;
+	int *iv;
+} fixed_ints[] = {
+	{"watchdog-timeout", &dev_timeout},
+	{"realtime", &realtime},
+	{"priority", &schedprio},
+	{"keepalive-thread", &ka_thread_mode},
+	{"keepalive-stale", &ka_stale},
+	{"check-workers", &check_workers},
+};
+
+static const struct {
+	const char *name;
+	char **str;
+} fixed_strings[] = {
+	{"watchdog-device", &devname},
+	{"log-dir", &logdir},
+};
+
+static void save_options(struct option_values *vals)
 {
-	FILE *wc;
-	char *line = NULL, *arg=NULL, *val=NULL;
-	size_t n = 0;
-	int linecount = 0;
+	int ii;
 
-	maxload5 = maxload15 = 0;
+	for (ii = 0; ii < NUM_INT_OPTIONS; ii++)
+		vals->iv[ii] = *int_options[ii];
+	for (ii = 0; ii < NUM_STRING_OPTIONS; ii++)
+		vals->str[ii] = *string_options[ii];
+}
 
-	if ((wc = fopen(configfile, "r")) == NULL) {
-		fatal_error(EX_SYSERR, "Can't open config file \"%s\" (%s)", configfile, strerror(errno));
+static void restore_options(const struct option_values *vals)
+{
+	int ii;
+
+	for (ii = 0; ii < NUM_INT_OPTIONS; ii++)
+		*int_options[ii] = vals->iv[ii];
+	for (ii = 0; ii < NUM_STRING_OPTIONS; ii++)
+		*string_options[ii] = vals->str[ii];
+
+	ticker = logtick;
+}
+
+/*
+ * Free an option string read from the configuration, unless it is a compiled in
+ * default.
+ */
+
+static void free_option(char *str)
+{
+	int ii;
+
+	if (str == NULL)
+		return;
+
+	for (ii = 0; ii < NUM_STRING_OPTIONS; ii++) {
+		if (str == defaults.str[ii])
+			return;
 	}
 
+	free(str);
+}
+
+static int same_string(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+
+	return (strcmp(a, b) == 0);
+}
+
+/*
+ * Parse the open configuration file 'wc', named 'fname', and set the global
+ * configuration variables to its values. 'depth' counts the includes that led here.
+ */
+
+static void parse_config(const char *fname, FILE *wc, int depth)
+{
+	char *line = NULL, *arg=NULL, *val=NULL;
+	size_t n = 0;
+	int linecount = 0;
+	struct list *last_entry = NULL;	/* For check-interval & check-phase. */
+
 	while (getline(&line, &n, wc) != -1) {
 		int itmp = 0;
 		linecount++;
+		read_location(fname, linecount);
 
 		/* find first non-white space character and check for blank/commented lines. */
 		arg = str_start(line);
@@ -172,7 +338,7 @@ void read_config(char *configfile)
 		/* find the '=' for the "arg = val" parsing. */
 		val = strchr(arg, '=');
 		if (val == NULL) {
-			log_message(LOG_WARNING, "Warning: no '=' assignment at line %d of config file", linecount);
+			log_message(LOG_WARNING, "Warning: no '=' assignment at line %d of %s", linecount, fname);
 			continue;
 		}
 
@@ -186,34 +352,38 @@ void read_config(char *configfile)
 
 		/* Search for a match. Note that the read_*_func() calls deal with a zero-length 'val' as needed. */
 		if (READ_LIST(FILENAME, &file_list) == 0) {
+			last_entry = list_tail(file_list);
 		} else if (READ_INT(CHANGE, &itmp) == 0) {
 			struct list *ptr;
 			if (!file_list) {	/* no file entered yet */
 				log_message(LOG_WARNING,
-					"Warning: file change interval, but no file (yet) at line %d of config file", linecount);
+					"Warning: file change interval, but no file (yet) at line %d of %s", linecount, fname);
 			} else {
-				for (ptr = file_list; ptr->next != NULL; ptr = ptr->next) {
-					/* loop to find end of list. */
-				}
+				ptr = list_tail(file_list);
 
 				if (ptr->parameter.file.mtime != 0)
 					log_message(LOG_WARNING,
-						"Warning: duplicate change interval at line %d of config file (ignoring previous)", linecount);
+						"Warning: duplicate change interval at line %d of %s (ignoring previous)", linecount, fname);
 
 				ptr->parameter.file.mtime = itmp;
 			}
 		} else if (READ_LIST(SERVERPIDFILE, &pidfile_list) == 0) {
+			last_entry = list_tail(pidfile_list);
 		} else if (READ_INT(PINGCOUNT, &pingcount) == 0) {
 		} else if (READ_LIST(PING, &target_list) == 0) {
+			last_entry = list_tail(target_list);
 		} else if (READ_LIST(INTERFACE, &iface_list) == 0) {
+			last_entry = list_tail(iface_list);
 		} else if (READ_ENUM(REALTIME, &realtime) == 0) {
 		} else if (READ_INT(PRIORITY, &schedprio) == 0) {
 		} else if (READ_STRING(REPAIRBIN, &repair_bin) == 0) {
 		} else if (READ_INT(REPAIRTIMEOUT, &repair_timeout) == 0) {
 		} else if (READ_LIST(TESTBIN, &tr_bin_list) == 0) {
+			last_entry = list_tail(tr_bin_list);
 		} else if (READ_INT(TESTTIMEOUT, &test_timeout) == 0) {
 		} else if (READ_STRING(HEARTBEAT, &heartbeat) == 0) {
 		} else if (READ_INT(HBSTAMPS, &hbstamps) == 0) {
+		} else if (READ_ENUM(HBFORMAT, &hb_binary) == 0) {
 		} else if (READ_STRING(ADMIN, &admin) == 0) {
 		} else if (READ_INT(INTERVAL, &tint) == 0) {
 		} else if (READ_INT(LOGTICK, &logtick) == 0) {
@@ -221,8 +391,9 @@ void read_config(char *configfile)
 		} else if (READ_STRING(DEVICE, &devname) == 0) {
 		} else if (READ_INT(DEVICE_TIMEOUT, &dev_timeout) == 0) {
 		} else if (strcmp(arg, TEMP) == 0) {
-			log_message(LOG_WARNING, "Warning: Use of '%s' at line %d of config file is depreciated", TEMP, linecount);
+			log_message(LOG_WARNING, "Warning: Use of '%s' at line %d of %s is depreciated", TEMP, linecount, fname);
 		} else if (READ_LIST(TEMPSENSOR, &temp_list) == 0) {
+			last_entry = list_tail(temp_list);
 		} else if (READ_INT(MAXTEMP, &maxtemp) == 0) {
 		} else if (READ_INT(MAXLOAD1, &maxload1) == 0) {
 		} else if (READ_INT(MAXLOAD5, &maxload5) == 0) {
@@ -236,18 +407,250 @@ void read_config(char *configfile)
 		} else if (READ_INT(RETRYTIMEOUT, &retry_timeout) == 0) {
 		} else if (READ_INT(REPAIRMAX, &repair_max) == 0) {
 		} else if (READ_ENUM(VERBOSE, &verbose) == 0) {
+		} else if (READ_INT(CHECKINTERVAL, &itmp) == 0) {
+			if (last_entry == NULL) {
+				log_message(LOG_WARNING,
+					"Warning: check interval, but no list entry (yet) at line %d of %s", linecount, fname);
+			} else {
+				last_entry->interval = itmp;
+			}
+		} else if (READ_INT(CHECKPHASE, &itmp) == 0) {
+			if (last_entry == NULL) {
+				log_message(LOG_WARNING,
+					"Warning: check phase, but no list entry (yet) at line %d of %s", linecount, fname);
+			} else {
+				last_entry->phase = itmp;
+			}
+		} else if (READ_INT(LOADINTERVAL, &load_interval) == 0) {
+		} else if (READ_INT(MEMINTERVAL, &memory_interval) == 0) {
+		} else if (READ_INT(TEMPINTERVAL, &temp_interval) == 0) {
+		} else if (READ_INT(FILEINTERVAL, &file_interval) == 0) {
+		} else if (READ_INT(PIDINTERVAL, &pidfile_interval) == 0) {
+		} else if (READ_INT(IFINTERVAL, &iface_interval) == 0) {
+		} else if (READ_INT(PINGINTERVAL, &ping_interval) == 0) {
+		} else if (READ_INT(TESTINTERVAL, &test_interval) == 0) {
+		} else if (READ_ENUM(KATHREAD, &ka_thread_mode) == 0) {
+		} else if (READ_INT(KASTALE, &ka_stale) == 0) {
+		} else if (READ_INT(KASPACING, &ka_spacing) == 0) {
+		} else if (READ_ENUM(PINGADAPT, &ping_adaptive) == 0) {
+		} else if (READ_INT(PINGMINRTO, &ping_min_rto) == 0) {
+		} else if (READ_INT(PINGMAXLOSS, &ping_max_loss) == 0) {
+		} else if (READ_INT(PINGMAXRTT, &ping_max_rtt) == 0) {
+		} else if (READ_INT(PINGWINDOW, &ping_window) == 0) {
+		} else if (READ_INT(CHECKWORKERS, &check_workers) == 0) {
+		} else if (READ_INT(LATENCYINT, &latency_interval) == 0) {
+		} else if (READ_STRING(STATSFILE, &stats_file) == 0) {
+		} else if (READ_STRING(METRICSSOCKET, &metrics_socket) == 0) {
+		} else if (READ_STRING(CONTROLSOCKET, &control_socket) == 0) {
+		} else if (strcmp(arg, INCLUDE) == 0) {
+			if (*val == '\0') {
+				log_message(LOG_WARNING, "Warning: file name expected for '%s' at line %d of %s", arg, linecount, fname);
+			} else {
+				parse_include(fname, val, depth + 1);
+			}
+			/* A check-interval after this is not meant for the included file's entries. */
+			last_entry = NULL;
+			read_location(fname, linecount);
 		} else {
-			log_message(LOG_WARNING, "Ignoring invalid option at line %d of config file: %s=%s", linecount, arg, val);
+			log_message(LOG_WARNING, "Ignoring invalid option at line %d of %s: %s=%s", linecount, fname, arg, val);
 		}
 	}
 
 	if (line)
 		free(line);
 
+	read_location(NULL, 0);
+}
+
+/*
+ * The real paths of the files and directories taken up by the current read of the
+ * configuration, so one that is included twice (say "include = watchdog.conf.d"
+ * as well as the drop-ins) or an include loop does not add every entry again.
+ */
+
+static char **read_paths = NULL;
+static int num_read = 0, max_read = 0;
+
+/*
+ * Note 'path' as read, returns FALSE (and logs it) if it already was.
+ */
+
+static int first_read(const char *path)
+{
+	char real[PATH_MAX];
+	int ii;
+
+	/* If it can't be found the open will say so. */
+	if (realpath(path, real) == NULL)
+		return TRUE;
+
+	for (ii = 0; ii < num_read; ii++) {
+		if (strcmp(read_paths[ii], real) == 0) {
+			log_message(LOG_WARNING, "config %s already read, skipped", path);
+			return FALSE;
+		}
+	}
+
+	if (num_read >= max_read) {
+		max_read += READ_CHUNK;
+		read_paths = (char **)realloc(read_paths, max_read * sizeof(char *));
+		if (read_paths == NULL) {
+			fatal_error(EX_SYSERR, "out of memory for config file names");
+		}
+	}
+
+	read_paths[num_read++] = xstrdup(real);
+	return TRUE;
+}
+
+static void forget_reads(void)
+{
+	while (num_read > 0)
+		free(read_paths[--num_read]);
+}
+
+/*
+ * Parse another configuration file, as included or found in the drop-in directory.
+ * Unlike the main file, one that can't be read is only reported.
+ */
+
+static void parse_file(const char *fname, int depth)
+{
+	FILE *wc;
+
+	if (!first_read(fname))
+		return;
+
+	if ((wc = fopen(fname, "r")) == NULL) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open config file %s, skipped (errno = %d = '%s')", fname, err, strerror(err));
+		return;
+	}
+
+	if (verbose)
+		log_message(LOG_DEBUG, "reading config file %s", fname);
+
+	parse_config(fname, wc, depth);
+	fclose(wc);
+}
+
+static int conf_fragment(const struct dirent *d)
+{
+	size_t len = strlen(d->d_name);
+
+	return (d->d_name[0] != '.' && len > 5 && strcmp(d->d_name + len - 5, ".conf") == 0);
+}
+
+static int fragment_order(const struct dirent **a, const struct dirent **b)
+{
+	/* Plain byte order so the result does not depend on the locale. */
+	return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/*
+ * Parse every "*.conf" file in the directory 'dname' in lexical order.
+ */
+
+static void parse_dir(const char *dname, int depth)
+{
+	struct dirent **names;
+	char fname[PATH_MAX];
+	struct stat sb;
+	int ii, num;
+
+	if (!first_read(dname))
+		return;
+
+	num = scandir(dname, &names, conf_fragment, fragment_order);
+	if (num < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot read config directory %s (errno = %d = '%s')", dname, err, strerror(err));
+		return;
+	}
+
+	for (ii = 0; ii < num; ii++) {
+		if (snprintf(fname, sizeof(fname), "%s/%s", dname, names[ii]->d_name) < (int)sizeof(fname) &&
+		    stat(fname, &sb) == 0 && S_ISREG(sb.st_mode)) {
+			parse_file(fname, depth);
+		}
+		free(names[ii]);
+	}
+
+	free(names);
+}
+
+/*
+ * Follow 'include = name' found in the file 'from'. The name is either a file or a
+ * directory of "*.conf" files, and if relative is taken from the directory of 'from'.
+ */
+
+static void parse_include(const char *from, const char *name, int depth)
+{
+	char path[PATH_MAX];
+	const char *slash = strrchr(from, '/');
+	struct stat sb;
+
+	if (depth > MAX_INCLUDE) {
+		log_message(LOG_ERR, "include of %s in %s is nested too deeply, skipped", name, from);
+		return;
+	}
+
+	if (name[0] != '/' && slash != NULL)
+		snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - from), from, name);
+	else
+		snprintf(path, sizeof(path), "%s", name);
+
+	if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode))
+		parse_dir(path, depth);
+	else
+		parse_file(path, depth);
+}
+
+/*
+ * Parse the drop-in directory of the main configuration file, "watchdog.conf.d"
+ * for "watchdog.conf", if there is one.
+ */
+
+static void parse_drop_ins(const char *configfile)
+{
+	char dname[PATH_MAX];
+	struct stat sb;
+
+	if (snprintf(dname, sizeof(dname), "%s.d", configfile) < (int)sizeof(dname) &&
+	    stat(dname, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+		parse_dir(dname, 1);
+	}
+}
+
+/*
+ * Open the configuration file, read & parse it, and set the global configuration variables to those values.
+ */
+
+void read_config(char *configfile)
+{
+	FILE *wc;
+
+	if (!have_defaults) {
+		save_options(&defaults);
+		have_defaults = TRUE;
+	}
+
+	maxload5 = maxload15 = 0;
+
+	if ((wc = fopen(configfile, "r")) == NULL) {
+		fatal_error(EX_SYSERR, "Can't open config file \"%s\" (%s)", configfile, strerror(errno));
+	}
+
+	first_read(configfile);
+	parse_config(configfile, wc, 0);
+
 	if (fclose(wc) != 0) {
 		fatal_error(EX_SYSERR, "Error closing file \"%s\" (%s)", configfile, strerror(errno));
 	}
 
+	parse_drop_ins(configfile);
+	forget_reads();
+
 	add_test_binaries(test_dir);
 	check_RTC_time();
 
@@ -321,6 +724,194 @@ static void add_test_binaries(const char *path)
 	closedir(d);
 }
 
+/*
+ * Copy what the daemon has learnt about each entry of 'old' to the entry of the same
+ * name in 'list', so a reload does not lose the retry timers, repair counts and
+ * statistics. The 'parameter' state is only copied if 'with_param' is set, as for
+ * some lists it comes from the configuration file. Returns the number of 'list'
+ * entries that were in 'old'.
+ */
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp((*(const struct list *const *)a)->name, (*(const struct list *const *)b)->name);
+}
+
+static int keep_state(struct list *list, struct list *old, int with_param)
+{
+	struct list **sorted, key, *keyp = &key, **found;
+	int ii, num = list_count(old), kept = 0;
+
+	if (num == 0)
+		return 0;
+
+	/* Look the names up in a sorted copy, so a reload of a long list stays quick. */
+	sorted = (struct list **)xcalloc(num, sizeof(struct list *));
+	for (ii = 0; ii < num; ii++)
+		sorted[ii] = &old[ii];
+	qsort(sorted, num, sizeof(struct list *), by_name);
+
+	for (; list != NULL; list = list->next) {
+		const struct list *prev;
+
+		key.name = list->name;
+		found = (struct list **)bsearch(&keyp, sorted, num, sizeof(struct list *), by_name);
+		if (found == NULL)
+			continue;
+
+		prev = *found;
+		list->last_time = prev->last_time;
+		list->repair_count = prev->repair_count;
+		*list->latency = *prev->latency;
+		list->last_latency = prev->last_latency;
+		list->last_result = prev->last_result;
+		list->checks = prev->checks;
+		list->errors = prev->errors;
+		list->paused = prev->paused;
+		if (with_param)
+			list->parameter = prev->parameter;
+		kept++;
+	}
+
+	free(sorted);
+	return kept;
+}
+
+/*
+ * Read the configuration file again for a reload. Options missing from it go back
+ * to their defaults, apart from those only taken up at start-up which keep their
+ * running values. The lists in use are handed back in 'old', and any entry still
+ * in the file keeps its state. The caller is left to either take up the new
+ * settings and free 'old', or put the running ones back with revert_config().
+ *
+ * Returns -1, with nothing changed, if the file can't be read.
+ */
+
+int reread_config(char *configfile, struct config_lists *old)
+{
+	int fixed_iv[sizeof(fixed_ints) / sizeof(fixed_ints[0])];
+	char *fixed_str[sizeof(fixed_strings) / sizeof(fixed_strings[0])];
+	FILE *wc;
+	int ii, kept, total;
+
+	if ((wc = fopen(configfile, "r")) == NULL) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open config file %s (errno = %d = '%s')", configfile, err, strerror(err));
+		return -1;
+	}
+
+	save_options(&running);
+	for (ii = 0; ii < (int)(sizeof(fixed_ints) / sizeof(fixed_ints[0])); ii++)
+		fixed_iv[ii] = *fixed_ints[ii].iv;
+	for (ii = 0; ii < (int)(sizeof(fixed_strings) / sizeof(fixed_strings[0])); ii++)
+		fixed_str[ii] = *fixed_strings[ii].str;
+
+	old->tr_bin = tr_bin_list;
+	old->file = file_list;
+	old->target = target_list;
+	old->pidfile = pidfile_list;
+	old->iface = iface_list;
+	old->temp = temp_list;
+	tr_bin_list = file_list = target_list = pidfile_list = iface_list = temp_list = NULL;
+
+	restore_options(&defaults);
+	first_read(configfile);
+	parse_config(configfile, wc, 0);
+
+	if (fclose(wc) != 0) {
+		int err = errno;
+		log_message(LOG_ERR, "error closing config file %s (errno = %d = '%s')", configfile, err, strerror(err));
+	}
+
+	parse_drop_ins(configfile);
+	forget_reads();
+
+	add_test_binaries(test_dir);
+
+	for (ii = 0; ii < (int)(sizeof(fixed_ints) / sizeof(fixed_ints[0])); ii++) {
+		if (*fixed_ints[ii].iv != fixed_iv[ii]) {
+			log_message(LOG_WARNING, "%s only changes on restart, still using %d", fixed_ints[ii].name, fixed_iv[ii]);
+			*fixed_ints[ii].iv = fixed_iv[ii];
+		}
+	}
+
+	for (ii = 0; ii < (int)(sizeof(fixed_strings) / sizeof(fixed_strings[0])); ii++) {
+		if (!same_string(*fixed_strings[ii].str, fixed_str[ii])) {
+			log_message(LOG_WARNING, "%s only changes on restart, still using %s", fixed_strings[ii].name,
+				    (fixed_str[ii] != NULL) ? fixed_str[ii] : "[none]");
+			free_option(*fixed_strings[ii].str);
+			*fixed_strings[ii].str = fixed_str[ii];
+		}
+	}
+
+	/* A file's 'change' time-out is its parameter, so that comes from the new file. */
+	kept = keep_state(tr_bin_list, old->tr_bin, TRUE);
+	kept += keep_state(file_list, old->file, FALSE);
+	kept += keep_state(target_list, old->target, TRUE);
+	kept += keep_state(pidfile_list, old->pidfile, TRUE);
+	kept += keep_state(iface_list, old->iface, TRUE);
+	kept += keep_state(temp_list, old->temp, TRUE);
+
+	total = list_count(tr_bin_list) + list_count(file_list) + list_count(target_list) +
+		list_count(pidfile_list) + list_count(iface_list) + list_count(temp_list);
+
+	log_message(LOG_INFO, "read %s: %d check(s) kept, %d added, %d removed", configfile, kept, total - kept,
+		    list_count(old->tr_bin) + list_count(old->file) + list_count(old->target) +
+		    list_count(old->pidfile) + list_count(old->iface) + list_count(old->temp) - kept);
+
+	return 0;
+}
+
+/*
+ * Go back to the settings in use before reread_config(), which handed back their
+ * lists in 'old'.
+ */
+
+void revert_config(struct config_lists *old)
+{
+	int ii;
+
+	free_all_lists();
+
+	tr_bin_list = old->tr_bin;
+	file_list = old->file;
+	target_list = old->target;
+	pidfile_list = old->pidfile;
+	iface_list = old->iface;
+	temp_list = old->temp;
+	memset(old, 0, sizeof(*old));
+
+	for (ii = 0; ii < NUM_STRING_OPTIONS; ii++) {
+		if (*string_options[ii] != running.str[ii])
+			free_option(*string_options[ii]);
+	}
+
+	restore_options(&running);
+}
+
+/*
+ * Free the lists handed back by reread_config(), and the option strings the new
+ * settings replaced, once they are no longer in use.
+ */
+
+void free_config_lists(struct config_lists *lists)
+{
+	int ii;
+
+	for (ii = 0; ii < NUM_STRING_OPTIONS; ii++) {
+		if (running.str[ii] != *string_options[ii])
+			free_option(running.str[ii]);
+		running.str[ii] = *string_options[ii];
+	}
+
+	free_list(&lists->tr_bin);
+	free_list(&lists->file);
+	free_list(&lists->target);
+	free_list(&lists->pidfile);
+	free_list(&lists->iface);
+	free_list(&lists->temp);
+}
+
 /*
  * Free all of the lists allocated by read_config()
  */
@@ -0,0 +1,170 @@
+/* > control.c
+ *
+ * Local control socket for changing the daemon's behaviour while it runs,
+ * without closing the watchdog device. A client connects to the Unix socket,
+ * sends one command line and reads the reply until the daemon closes the
+ * connection, for example:
+ *
+ *	echo "pause /var/run/sshd.pid" | socat - UNIX-CONNECT:/run/watchdog.ctl
+ *
+ * Only root and the daemon's own user are accepted, as checked with SO_PEERCRED,
+ * and the socket itself is only accessible to the daemon's user.
+ *
+ * The socket is served by unix_server.c from the main loop's event set and never
+ * blocks. The commands are carried out by a function the main loop registers,
+ * which only changes its state (such as making a check due) so the device
+ * refresh is not held up.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "extern.h"
+#include "read-conf.h"		/* For str_start() */
+#include "stats.h"
+
+#define MAX_CLIENTS	4
+#define REPLY_BASE	4096	/* Reply buffer size... */
+#define REPLY_ENTRY	256	/* ...plus this much for each check, for the state dump. */
+
+static int command_complete(const char *in);
+static void respond(struct server_client *c);
+static void release_reply(struct server_client *c);
+
+static const char reply_denied[] = "error: permission denied\n";
+static const char reply_wait[] = "error: busy, try again\n";
+
+static struct unix_server server = {
+	.what = "control",
+	.max_clients = MAX_CLIENTS,
+	.private = TRUE,
+	.denied = reply_denied,
+	.complete = command_complete,
+	.respond = respond,
+	.release = release_reply,
+};
+
+static control_func handler = NULL;
+
+static char *reply = NULL;
+static size_t reply_size = 0;
+static size_t reply_len = 0;
+static int reply_busy = FALSE;	/* A client is still being sent 'reply'. */
+
+/*
+ * Add to the reply to the current command, for use by the command function.
+ */
+
+void control_reply(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (reply == NULL || reply_len >= reply_size - 1)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(reply + reply_len, reply_size - reply_len, fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	reply_len += len;
+	if (reply_len >= reply_size)
+		reply_len = reply_size - 1;
+}
+
+/* Wait for the whole command line. */
+static int command_complete(const char *in)
+{
+	return (strchr(in, '\n') != NULL);
+}
+
+static void release_reply(struct server_client *c)
+{
+	if (c->out == reply)
+		reply_busy = FALSE;
+}
+
+/*
+ * Split the command line in to the command and its argument, and have it run.
+ */
+
+static void respond(struct server_client *c)
+{
+	char *cmd, *arg, *end;
+
+	if (reply_busy) {
+		c->out = reply_wait;
+		c->out_len = sizeof(reply_wait) - 1;
+		return;
+	}
+
+	cmd = str_start(c->in);
+	end = cmd + strcspn(cmd, "\r\n");
+	*end = '\0';
+
+	arg = cmd + strcspn(cmd, " \t");
+	if (*arg) {
+		*arg++ = '\0';
+		arg = str_start(arg);
+	}
+
+	log_message(LOG_NOTICE, "control command '%s%s%s' from pid %d uid %d", cmd, (*arg) ? " " : "", arg,
+		    c->pid, c->uid);
+
+	reply_len = 0;
+	reply[0] = '\0';
+	(*handler) (cmd, arg);
+
+	c->out = reply;
+	c->out_len = reply_len;
+	reply_busy = TRUE;
+}
+
+/*
+ * Create the socket named by 'control_socket' and serve it from the event loop,
+ * calling 'func' for each command.
+ */
+
+int open_control(control_func func)
+{
+	const struct ws_header *hdr = stats_snapshot();
+
+	close_control();
+
+	if (control_socket == NULL || func == NULL)
+		return 0;
+
+	if (server_open(&server, control_socket) < 0)
+		return -1;
+
+	reply_size = REPLY_BASE + ((hdr != NULL) ? hdr->nentries : 0) * REPLY_ENTRY;
+	reply = (char *)xcalloc(1, reply_size);
+	reply_busy = FALSE;
+	handler = func;
+
+	log_message(LOG_INFO, "accepting control commands on %s", control_socket);
+	return 0;
+}
+
+int close_control(void)
+{
+	if (server_close(&server) < 0)
+		return -1;
+
+	free(reply);
+	reply = NULL;
+	reply_size = reply_len = 0;
+	handler = NULL;
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/* > cost.c
+ *
+ * Running counts of the system calls made and the processes forked by the
+ * daemon, for measuring what each check costs (see the --profile option).
+ *
+ * The system calls are counted by the raw_syscalls:sys_enter trace point when
+ * the kernel lets us open it, which counts every call made by the thread that
+ * opened it. Otherwise we fall back to the read and write calls the kernel keeps
+ * count of in /proc/thread-self/io, which misses calls such as stat() and kill().
+ * Forks are counted by a pthread_atfork() handler, so cover every thread.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "extern.h"
+
+static const char *const trace_ids[] = {
+	"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+	"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	NULL
+};
+
+static const char io_name[] = "/proc/thread-self/io";
+
+static int perf_fd = -1;
+static int io_fd = -1;
+static int fork_handler = FALSE;
+static volatile unsigned long forks = 0;
+
+static void count_fork(void)
+{
+	__sync_fetch_and_add(&forks, 1);
+}
+
+/*
+ * Read a small file in to 'buf' as a string. Returns its length, or -1.
+ */
+
+static int read_small(int fd, const char *fname, char *buf, size_t size)
+{
+	ssize_t len;
+
+	if (fd < 0 && (fd = open(fname, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+
+	len = pread(fd, buf, size - 1, 0);
+	if (fd != io_fd)
+		close(fd);
+
+	if (len < 0)
+		return -1;
+
+	buf[len] = '\0';
+	return (int)len;
+}
+
+static int open_trace_point(void)
+{
+	struct perf_event_attr attr;
+	char buf[32];
+	int ii, fd;
+
+	for (ii = 0; trace_ids[ii] != NULL; ii++) {
+		if (read_small(-1, trace_ids[ii], buf, sizeof(buf)) > 0)
+			break;
+	}
+
+	if (trace_ids[ii] == NULL)
+		return -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.size = sizeof(attr);
+	attr.config = strtoull(buf, NULL, 10);
+
+	fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0 && verbose) {
+		int err = errno;
+		log_message(LOG_DEBUG, "cannot count system calls with perf (errno = %d = '%s')", err, strerror(err));
+	}
+
+	return fd;
+}
+
+/*
+ * Start counting. Returns 0 if the system calls can be counted, -1 if only the
+ * forks can be.
+ */
+
+int open_cost(void)
+{
+	close_cost();
+
+	if (!fork_handler) {
+		/* There is no taking this back again, it is harmless once finished with. */
+		pthread_atfork(NULL, count_fork, NULL);
+		fork_handler = TRUE;
+	}
+
+	if ((perf_fd = open_trace_point()) >= 0)
+		return 0;
+
+	if ((io_fd = open(io_name, O_RDONLY | O_CLOEXEC)) >= 0)
+		return 0;
+
+	return -1;
+}
+
+/*
+ * Say how the system calls are being counted, for the report.
+ */
+
+const char *cost_source(void)
+{
+	if (perf_fd >= 0)
+		return "all system calls";
+
+	if (io_fd >= 0)
+		return "read/write system calls only";
+
+	return "system calls not counted";
+}
+
+/*
+ * Fill in 'cost' with the counts so far. Only the differences between two of these
+ * mean anything, and the system calls are those of the calling thread. Returns -1
+ * if the system calls are not known.
+ */
+
+int read_cost(struct cost *cost)
+{
+	char buf[256];
+	const char *ptr;
+
+	cost->forks = forks;
+	cost->syscalls = 0;
+
+	if (perf_fd >= 0) {
+		unsigned long long val;
+
+		if (read(perf_fd, &val, sizeof(val)) != sizeof(val))
+			return -1;
+
+		cost->syscalls = val;
+		return 0;
+	}
+
+	if (io_fd < 0 || read_small(io_fd, io_name, buf, sizeof(buf)) < 0)
+		return -1;
+
+	if ((ptr = strstr(buf, "syscr:")) != NULL)
+		cost->syscalls += strtoull(ptr + 6, NULL, 10);
+	if ((ptr = strstr(buf, "syscw:")) != NULL)
+		cost->syscalls += strtoull(ptr + 6, NULL, 10);
+
+	return 0;
+}
+
+int close_cost(void)
+{
+	if (perf_fd >= 0)
+		close(perf_fd);
+	if (io_fd >= 0)
+		close(io_fd);
+
+	perf_fd = io_fd = -1;
+	return 0;
+}
@@ -63,6 +63,8 @@ const char *wd_strerror(int err)
 		case ETOOLONG:		str = "child process did not return in time"; break;
 		case EUSERVALUE:	str = "user-reserved code"; break;
 		case EDONTKNOW:		str = "unknown (neither good nor bad)"; break;
+		case EPINGLOSS:		str = "ping loss too high"; break;
+		case ESLOWPING:		str = "ping round trip time too long"; break;
 		default:			str = strerror(err); break;
 	}
 
@@ -0,0 +1,389 @@
+/* > event_loop.c
+ *
+ * Simple epoll based reactor for the main loop. The daemon sleeps on a single
+ * epoll set that holds a timerfd (armed with an absolute CLOCK_MONOTONIC deadline
+ * so the loop period does not drift by the time the checks take) along with any
+ * sockets or other file handles that have work for us, and a self-pipe used to
+ * report SIGCHLD so finished test binaries are collected as soon as they exit.
+ *
+ * If epoll or timerfd are not available we fall back to an absolute-time
+ * clock_nanosleep() so the period is still kept, but other events are only
+ * seen at the next tick.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE	/* For pipe2() and O_CLOEXEC on older systems. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define MAX_EVENTS	16
+
+struct event_src {
+	int fd;
+	event_func func;
+	void *ptr;
+	struct event_src *next;
+};
+
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int sigchld_pipe[2] = {-1, -1};
+static event_func child_func = NULL;
+static struct event_src *src_head = NULL;
+
+/*
+ * Sources removed while event_wait() is dispatching are kept here until the batch
+ * is done, as a later event in the same batch may still point at them.
+ */
+static struct event_src *src_dead = NULL;
+static int dispatching = FALSE;
+
+/* Set by event_break() to have event_wait() return once the current batch is done. */
+static volatile sig_atomic_t wait_break = FALSE;
+
+/* Marker used as the epoll data for the two internal handles. */
+static int timer_tag, sigchld_tag;
+
+/*
+ * SIGCHLD handler, just poke the self-pipe so epoll_wait() returns. The errno
+ * value is preserved as we can interrupt anything in the main code.
+ */
+
+static void sigchld_handler(int arg)
+{
+	int err = errno;
+
+	if (sigchld_pipe[1] != -1) {
+		if (write(sigchld_pipe[1], "C", 1) < 0) {
+			/* Pipe full is fine, a wake-up is already pending. */
+		}
+	}
+
+	errno = err;
+}
+
+/*
+ * Empty a non-blocking file handle we only use for wake-ups.
+ */
+
+static void drain_fd(int fd)
+{
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0) {
+	}
+}
+
+static int add_epoll(int fd, unsigned int events, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot add fd %d to event loop (errno = %d = '%s')", fd, err, strerror(err));
+		return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Create the epoll set and its timer. Return 0 on success, or -1 if we have to
+ * run in the simpler sleep-based mode.
+ */
+
+int open_event_loop(void)
+{
+	close_event_loop();
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot create event loop (errno = %d = '%s')", err, strerror(err));
+		return -1;
+	}
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot create loop timer (errno = %d = '%s')", err, strerror(err));
+		close_event_loop();
+		return -1;
+	}
+
+	if (add_epoll(timer_fd, EPOLLIN, &timer_tag)) {
+		close_event_loop();
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Register a function to be called from event_wait() each time a child process
+ * changes state. The function is called with fd=-1 and the supplied pointer.
+ */
+
+int event_watch_children(event_func func)
+{
+	struct sigaction sa;
+
+	if (epoll_fd == -1 || func == NULL)
+		return -1;
+
+	if (sigchld_pipe[0] == -1) {
+		if (pipe2(sigchld_pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "cannot create child pipe (errno = %d = '%s')", err, strerror(err));
+			return -1;
+		}
+
+		if (add_epoll(sigchld_pipe[0], EPOLLIN, &sigchld_tag)) {
+			return -1;
+		}
+	}
+
+	child_func = func;
+
+	/* SA_RESTART so normal system calls are not upset, SA_NOCLDSTOP as we only care about exits. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigchld_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	if (sigaction(SIGCHLD, &sa, NULL) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot set SIGCHLD handler (errno = %d = '%s')", err, strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Add a file handle to the set we wait on. The function 'func' is called from
+ * event_wait() with the epoll event bits when the handle becomes ready.
+ */
+
+int event_add_fd(int fd, unsigned int events, event_func func, void *ptr)
+{
+	struct event_src *src;
+
+	if (epoll_fd == -1 || fd < 0 || func == NULL)
+		return -1;
+
+	src = (struct event_src *)xcalloc(1, sizeof(struct event_src));
+	src->fd = fd;
+	src->func = func;
+	src->ptr = ptr;
+
+	if (add_epoll(fd, events, src)) {
+		free(src);
+		return -1;
+	}
+
+	src->next = src_head;
+	src_head = src;
+
+	return 0;
+}
+
+static void free_dead(void)
+{
+	while (src_dead != NULL) {
+		struct event_src *src = src_dead;
+		src_dead = src->next;
+		free(src);
+	}
+}
+
+/*
+ * Remove a file handle, call this before closing it. This may be called from an
+ * event function, including for its own handle.
+ */
+
+int event_del_fd(int fd)
+{
+	struct event_src *last = NULL, *src;
+
+	for (src = src_head; src != NULL; last = src, src = src->next) {
+		if (src->fd == fd) {
+			if (epoll_fd != -1)
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+
+			if (last == NULL)
+				src_head = src->next;
+			else
+				last->next = src->next;
+
+			if (dispatching) {
+				src->func = NULL;
+				src->next = src_dead;
+				src_dead = src;
+			} else {
+				free(src);
+			}
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Have event_wait() return early, for an event function that has changed the
+ * schedule (so the deadline it was given may now be too late), or a signal
+ * handler that has left work for the main loop. Safe to call from either.
+ */
+
+void event_break(void)
+{
+	wait_break = TRUE;
+}
+
+/*
+ * Wait until the absolute CLOCK_MONOTONIC time 'deadline', dispatching any events
+ * as they arrive. Returns early with -1 if interrupted by a signal that cleared
+ * _running, 0 when the deadline was reached or event_break() was called (which
+ * may have been before we got here, say by a signal while the checks ran).
+ */
+
+int event_wait(const struct timespec *deadline)
+{
+	struct itimerspec its;
+
+	if (wait_break) {
+		wait_break = FALSE;
+		return 0;
+	}
+
+	if (epoll_fd == -1) {
+		/* No epoll, simply sleep for the remaining time. */
+		while (_running) {
+			int rv = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+			if (rv == 0)
+				return 0;
+			if (rv != EINTR) {
+				log_message(LOG_ERR, "clock_nanosleep gave error %d = '%s'", rv, strerror(rv));
+				sleep(1);
+				return 0;
+			}
+			if (wait_break) {
+				wait_break = FALSE;
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value = *deadline;
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot set loop timer (errno = %d = '%s')", err, strerror(err));
+		sleep(1);
+		return 0;
+	}
+
+	while (_running) {
+		struct epoll_event events[MAX_EVENTS];
+		int ii, nev;
+
+		nev = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		if (nev < 0) {
+			int err = errno;
+			if (err != EINTR) {
+				log_message(LOG_ERR, "event wait gave error %d = '%s'", err, strerror(err));
+				sleep(1);
+				return 0;
+			}
+			if (wait_break) {
+				wait_break = FALSE;
+				return 0;
+			}
+			continue;
+		}
+
+		dispatching = TRUE;
+		for (ii = 0; ii < nev; ii++) {
+			void *ptr = events[ii].data.ptr;
+
+			if (ptr == &timer_tag) {
+				drain_fd(timer_fd);
+				dispatching = FALSE;
+				free_dead();
+				return 0;
+			} else if (ptr == &sigchld_tag) {
+				drain_fd(sigchld_pipe[0]);
+				if (child_func != NULL)
+					(*child_func) (-1, events[ii].events, NULL);
+			} else {
+				struct event_src *src = (struct event_src *)ptr;
+				if (src->func != NULL)
+					(*src->func) (src->fd, events[ii].events, src->ptr);
+			}
+		}
+		dispatching = FALSE;
+		free_dead();
+
+		if (wait_break) {
+			wait_break = FALSE;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Release everything created by open_event_loop(). Registered file handles are
+ * not closed here, they belong to whoever added them.
+ */
+
+int close_event_loop(void)
+{
+	while (src_head != NULL) {
+		struct event_src *src = src_head;
+		src_head = src->next;
+		free(src);
+	}
+	free_dead();
+
+	if (sigchld_pipe[0] != -1) {
+		signal(SIGCHLD, SIG_DFL);
+		close(sigchld_pipe[0]);
+		close(sigchld_pipe[1]);
+		sigchld_pipe[0] = sigchld_pipe[1] = -1;
+	}
+	child_func = NULL;
+
+	if (timer_fd != -1) {
+		close(timer_fd);
+		timer_fd = -1;
+	}
+
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+
+	return 0;
+}
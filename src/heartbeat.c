@@ -3,6 +3,10 @@
  * Groups together the code for the special heart-beat timestamps file
  * used for debug.
  *
+ * The original ASCII format rewrites the whole file on every beat. With
+ * "heartbeat-format = binary" the file is instead memory-mapped with the layout
+ * in heartbeat.h, so a beat only stores one slot. Use wd_heartbeat to read it.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
@@ -15,20 +19,165 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "watch_err.h"
 #include "extern.h"
+#include "heartbeat.h"
 
 static FILE *hb = NULL;
-static int lastts, nrts;
+/* 'nstamps' is the size of 'timestamps', a reload can change 'hbstamps' before we reopen. */
+static int lastts, nrts, nstamps;
 static char *timestamps = NULL;
 
+static struct hb_header *hb_map = NULL;
+static struct hb_slot *hb_slots = NULL;
+static size_t hb_map_size = 0;
+static uint64_t hb_index = 0;
+
 static void next_value(void)
 {
-	if (nrts < hbstamps)
+	if (nrts < nstamps)
 		nrts++;
 	++lastts;
-	lastts = lastts % hbstamps;
+	lastts = lastts % nstamps;
+}
+
+/*
+ * Read the kernel's boot id, a UUID string, into 'id'. Left as zero if unavailable.
+ */
+
+static void read_boot_id(uint8_t id[16])
+{
+	char buf[64];
+	int ii = 0, fd;
+	ssize_t len;
+	const char *cp;
+
+	memset(id, 0, 16);
+
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return;
+
+	buf[len] = '\0';
+	for (cp = buf; *cp && ii < 32; cp++) {
+		unsigned int nib;
+
+		if (*cp >= '0' && *cp <= '9')
+			nib = *cp - '0';
+		else if (*cp >= 'a' && *cp <= 'f')
+			nib = *cp - 'a' + 10;
+		else
+			continue;
+
+		id[ii / 2] |= (ii & 1) ? nib : nib << 4;
+		ii++;
+	}
+}
+
+/*
+ * Map the binary heartbeat file. An existing file is kept if it has a valid header
+ * for the same number of slots, anything else (including an ASCII heartbeat file)
+ * is replaced by an empty one.
+ */
+
+static int open_binary_heartbeat(void)
+{
+	struct stat st;
+	size_t size = sizeof(struct hb_header) + hbstamps * sizeof(struct hb_slot);
+	int fd, valid = FALSE;
+	uint32_t ii;
+
+	fd = open(heartbeat, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", heartbeat, err, strerror(err));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (st.st_size != (off_t) size) {
+		if (st.st_size != 0)
+			log_message(LOG_WARNING, "heartbeat file %s has the wrong size, starting it afresh", heartbeat);
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "cannot size %s (errno = %d = '%s')", heartbeat, err, strerror(err));
+			close(fd);
+			return -1;
+		}
+	}
+
+	hb_map = (struct hb_header *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hb_map == MAP_FAILED) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot map %s (errno = %d = '%s')", heartbeat, err, strerror(err));
+		hb_map = NULL;
+		return -1;
+	}
+
+	hb_map_size = size;
+	hb_slots = (struct hb_slot *)(hb_map + 1);
+
+	if (hb_map->magic == HB_MAGIC && hb_map->version == HB_VERSION &&
+	    hb_map->header_size == sizeof(struct hb_header) &&
+	    hb_map->slot_size == sizeof(struct hb_slot) && hb_map->nslots == (uint32_t) hbstamps) {
+		valid = TRUE;
+	} else if (hb_map->magic != 0) {
+		log_message(LOG_WARNING, "heartbeat file %s has an unknown header, starting it afresh", heartbeat);
+	}
+
+	if (!valid) {
+		memset(hb_map, 0, size);
+		hb_map->magic = HB_MAGIC;
+		hb_map->version = HB_VERSION;
+		hb_map->header_size = sizeof(struct hb_header);
+		hb_map->slot_size = sizeof(struct hb_slot);
+		hb_map->nslots = hbstamps;
+	}
+
+	/* The header index is only updated on close, so after a crash the slots know better. */
+	hb_index = hb_map->write_index;
+	for (ii = 0; ii < hb_map->nslots; ii++) {
+		if (hb_slots[ii].seq > hb_index)
+			hb_index = hb_slots[ii].seq;
+	}
+
+	hb_map->write_index = hb_index;
+	if (++hb_map->generation == 0)
+		hb_map->generation = 1;
+	read_boot_id(hb_map->boot_id);
+
+	return 0;
+}
+
+/*
+ * Store one beat, touching only its slot. The sequence number is cleared while the
+ * slot is filled in so a reader never takes a half written slot for a good one.
+ */
+
+static void write_binary_heartbeat(void)
+{
+	struct hb_slot *slot = &hb_slots[hb_index % hb_map->nslots];
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	slot->seq = 0;
+	__sync_synchronize();
+	slot->sec = ts.tv_sec;
+	slot->nsec = ts.tv_nsec;
+	slot->generation = hb_map->generation;
+	__sync_synchronize();
+	slot->seq = ++hb_index;
 }
 
 /*
@@ -42,7 +191,9 @@ int open_heartbeat(void)
 
 	close_heartbeat();
 
-	if (heartbeat != NULL) {
+	if (heartbeat != NULL && hb_binary) {
+		rv = open_binary_heartbeat();
+	} else if (heartbeat != NULL) {
 		hb = ((hb = fopen(heartbeat, "r+")) == NULL) ? fopen(heartbeat, "w+") : hb;
 		if (hb == NULL) {
 			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", heartbeat, errno, strerror(errno));
@@ -53,7 +204,8 @@ int open_heartbeat(void)
 			/* Allocate  memory for keeping the timestamps in */
 			nrts = 0;
 			lastts = 0;
-			timestamps = (char *)xcalloc(hbstamps, TS_SIZE);
+			nstamps = hbstamps;
+			timestamps = (char *)xcalloc(nstamps, TS_SIZE);
 			/* read any previous timestamps */
 			rewind(hb);
 			while (fgets(rbuf, TS_SIZE + 1, hb) != NULL) {
@@ -81,6 +233,11 @@ int write_heartbeat(void)
 	char tbuf[TS_SIZE + 1];
 	char tbufw[TS_SIZE + 1];
 
+	if (hb_map != NULL) {
+		write_binary_heartbeat();
+		return (ENOERR);
+	}
+
 	if (hb == NULL)
 		return (ENOERR);
 
@@ -102,9 +259,9 @@ int write_heartbeat(void)
 
 		/* write the buffer to the file */
 		rewind(hb);
-		if (nrts == hbstamps) {
+		if (nrts == nstamps) {
 			/* write from the logical start of the buffer to the physical end */
-			if (fwrite(timestamps + (lastts * TS_SIZE), TS_SIZE, hbstamps - lastts, hb) != (hbstamps - lastts)) {
+			if (fwrite(timestamps + (lastts * TS_SIZE), TS_SIZE, nstamps - lastts, hb) != (nstamps - lastts)) {
 				int err = errno;
 				log_message(LOG_ERR, "write heartbeat file gave error %d = '%s'!", err, strerror(err));
 			}
@@ -137,6 +294,16 @@ int close_heartbeat(void)
 
 	hb = NULL;
 
+	if (hb_map != NULL) {
+		hb_map->write_index = hb_index;
+		if (munmap(hb_map, hb_map_size) == -1) {
+			log_message(LOG_ALERT, "cannot unmap %s (errno = %d)", heartbeat, errno);
+			rv = -1;
+		}
+		hb_map = NULL;
+		hb_slots = NULL;
+	}
+
 	if (timestamps != NULL) {
 		free(timestamps);
 		timestamps = NULL;
@@ -0,0 +1,126 @@
+/* > histogram.c
+ *
+ * Fixed size log-bucketed histograms for timing the checks, in the manner of
+ * HDR histograms. Values below HIST_SUB are counted exactly, above that each
+ * power of two is split in to HIST_SUB buckets, so any value is recorded to
+ * within about 12% and the whole 32-bit range fits in HIST_BUCKETS counters.
+ * Adding a sample never allocates memory.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "extern.h"
+
+static int bucket_index(unsigned long val)
+{
+	int shift = 0;
+
+	if (val > 0xffffffffUL)
+		val = 0xffffffffUL;
+
+	if (val < HIST_SUB)
+		return (int)val;
+
+	while ((val >> shift) >= 2 * HIST_SUB)
+		shift++;
+
+	return (shift + 1) * HIST_SUB + (int)((val >> shift) - HIST_SUB);
+}
+
+/*
+ * Highest value that is counted in bucket 'idx'.
+ */
+
+static unsigned long bucket_top(int idx)
+{
+	int shift;
+
+	if (idx < HIST_SUB)
+		return (unsigned long)idx;
+
+	shift = idx / HIST_SUB - 1;
+	return (((unsigned long)(HIST_SUB + idx % HIST_SUB) + 1) << shift) - 1;
+}
+
+void hist_clear(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void hist_add(struct histogram *h, unsigned long val)
+{
+	if (h->count == 0 || val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+
+	h->count++;
+	h->sum += val;
+	h->bucket[bucket_index(val)]++;
+}
+
+/*
+ * The value 'pct' percent of the samples are at or below, to the resolution of
+ * the buckets (but never more than the largest sample).
+ */
+
+unsigned long hist_percentile(const struct histogram *h, int pct)
+{
+	unsigned long long want, seen = 0;
+	int ii;
+
+	if (h->count == 0)
+		return 0;
+
+	want = (h->count * (unsigned long long)pct + 99) / 100;
+	if (want == 0)
+		want = 1;
+
+	for (ii = 0; ii < HIST_BUCKETS; ii++) {
+		seen += h->bucket[ii];
+		if (seen >= want)
+			return (bucket_top(ii) < h->max) ? bucket_top(ii) : h->max;
+	}
+
+	return h->max;
+}
+
+/*
+ * The number of samples in buckets that hold nothing above 'val', as used for
+ * the cumulative buckets of an exported histogram.
+ */
+
+unsigned long hist_count_below(const struct histogram *h, unsigned long val)
+{
+	unsigned long count = 0;
+	int ii;
+
+	for (ii = 0; ii < HIST_BUCKETS && bucket_top(ii) <= val; ii++)
+		count += h->bucket[ii];
+
+	return count;
+}
+
+/*
+ * Write a one line summary of 'h' then its non-empty buckets.
+ */
+
+void hist_write(FILE *fp, const char *name, const struct histogram *h)
+{
+	int ii;
+
+	fprintf(fp, "%-32s %10lu %10lu %10lu %10lu %10lu %10lu %10llu\n", name, h->count, h->min,
+		hist_percentile(h, 50), hist_percentile(h, 90), hist_percentile(h, 99), h->max,
+		(h->count > 0) ? h->sum / h->count : 0ULL);
+
+	for (ii = 0; ii < HIST_BUCKETS; ii++) {
+		if (h->bucket[ii] != 0)
+			fprintf(fp, "    <= %-10lu %u\n", bucket_top(ii), h->bucket[ii]);
+	}
+}
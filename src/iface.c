@@ -9,60 +9,47 @@
 #include "extern.h"
 #include "watch_err.h"
 
-#define NETDEV_LINE_LEN	128
+/* Room for a good number of interfaces, at some 120 characters each, grown if need be. */
+static char net_buf[16384];
+static struct proc_file net_file = PROC_FILE("/proc/net/dev", net_buf);
+
+/*
+ * Check the received byte count of 'dev' has moved on. All the interfaces share
+ * one read of /proc/net/dev for each pass of the main loop.
+ */
 
 int check_iface(struct list *dev)
 {
-	const char fname[] = "/proc/net/dev";
-	FILE *file = fopen(fname, "r");
+	const char *buf;
+	const char *keys[1];
+	long bytes;
+	int err;
 
-	if (file == NULL) {
-		int err = errno;
-		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", fname, err, strerror(err));
+	if ((err = proc_read(&net_file, &buf)) != ENOERR)
 		return (err);
-	}
 
-	/* read the file line by line */
-	while (!feof(file)) {
-		char line[NETDEV_LINE_LEN];
-		memset(line, 0, sizeof(line)); /* Just in case. */
+	keys[0] = dev->name;
+	if (proc_keys(buf, keys, &bytes, 1) == 1) {
+		/* do verbose logging */
+		if (verbose && logtick && ticker == 1)
+			log_message(LOG_DEBUG, "device %s received %lu bytes", dev->name, (unsigned long)bytes);
 
-		if (fgets(line, NETDEV_LINE_LEN, file) == NULL) {
-			if (!ferror(file)) {
-				break;
-			} else {
-				int err = errno;
-				log_message(LOG_ERR, "cannot read %s (errno = %d = '%s')", fname, err, strerror(err));
-				fclose(file);
-				return (err);
-			}
+		if (dev->parameter.iface.bytes == (unsigned long)bytes) {
+			log_message(LOG_ERR, "device %s did not receive anything since last check", dev->name);
+			return (ENETUNREACH);
 		} else {
-			int i = 0;
-
-			for (; line[i] == ' ' || line[i] == '\t'; i++) ;
-			if (strncmp(line + i, dev->name, strlen(dev->name)) == 0) {
-				unsigned long bytes = strtoul(line + i + strlen(dev->name) + 1, NULL, 10);
-
-				/* do verbose logging */
-				if (verbose && logtick && ticker == 1)
-					log_message(LOG_DEBUG, "device %s received %lu bytes", dev->name, bytes);
-
-				if (dev->parameter.iface.bytes == bytes) {
-					fclose(file);
-					log_message(LOG_ERR, "device %s did not receive anything since last check", dev->name);
-					return (ENETUNREACH);
-				} else {
-					dev->parameter.iface.bytes = bytes;
-				}
-			}
+			dev->parameter.iface.bytes = bytes;
 		}
-	}
-
-	if (fclose(file) != 0) {
-		int err = errno;
-		log_message(LOG_ERR, "cannot close %s (errno = %d = '%s')", fname, err, strerror(err));
-		return (err);
+		dev->parameter.iface.missing = FALSE;
+	} else if (!dev->parameter.iface.missing) {
+		log_message(LOG_WARNING, "device %s not found in /proc/net/dev", dev->name);
+		dev->parameter.iface.missing = TRUE;
 	}
 
 	return (ENOERR);
 }
+
+int close_ifacecheck(void)
+{
+	return proc_close(&net_file);
+}
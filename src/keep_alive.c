@@ -23,6 +23,8 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>			/* for ioctl() */
 #include <linux/watchdog.h>		/* for 'struct watchdog_info' */
+#include <pthread.h>
+#include <sched.h>
 
 #include "extern.h"
 #include "watch_err.h"
@@ -31,6 +33,47 @@ static int watchdog_fd = -1;
 static int timeout_used = TIMER_MARGIN;
 static int Refresh_using_ioctl = FALSE;
 
+/*
+ * CLOCK_MONOTONIC time of the last refresh (zero if none yet). Calls to keep_alive()
+ * closer together than 'keepalive-spacing' do nothing, so the number of device
+ * writes and heartbeat updates does not grow with the number of checks.
+ */
+static struct timespec last_refresh;
+
+/* Held while deciding on and doing a refresh, as check workers can call keep_alive() too. */
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Time between keep_alive() calls in usec, also under 'refresh_lock'. */
+static struct histogram call_spacing;
+static struct timespec last_call;
+
+/*
+ * A refresh with less than this percentage of the hardware time-out left is
+ * counted (and logged) as a near miss.
+ */
+#define NEAR_MISS_PCT	25
+
+/*
+ * Timing of the refreshes themselves, under 'refresh_lock'. The time left is read
+ * from the driver with WDIOC_GETTIMELEFT where it supports that, otherwise it is
+ * estimated from the time since the last refresh.
+ */
+static struct ka_stats stats = { .min_margin = -1, .last_margin = -1 };
+static int try_timeleft = TRUE;
+
+/*
+ * State shared with the optional keep-alive thread. The checker only advances
+ * 'progress' from keep_alive(), the thread refreshes the device on its own timer
+ * for as long as it sees that value change within 'stale_limit' seconds.
+ */
+static pthread_t ka_thread;
+static pthread_mutex_t ka_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ka_cond;
+static volatile int ka_running = FALSE;
+static unsigned long progress = 0;
+static int ka_error = ENOERR;
+static int stale_limit = 0;
+
 /*
  * Open the watchdog timer (if name non-NULL) and set the time-out value (if non-zero).
  */
@@ -74,6 +117,12 @@ int open_watchdog(char *name, int timeout)
 	 * See https://bugs.launchpad.net/ubuntu/+source/linux/+bug/932381
 	 *
 	 */
+	pthread_mutex_lock(&refresh_lock);
+	memset(&stats, 0, sizeof(stats));
+	stats.min_margin = stats.last_margin = -1;
+	try_timeleft = TRUE;
+	pthread_mutex_unlock(&refresh_lock);
+
 	Refresh_using_ioctl = FALSE;
 	if (strcmp("IT87 WDT", (char *)ident.identity) == 0) {
 		Refresh_using_ioctl = TRUE;
@@ -147,6 +196,8 @@ int set_watchdog_timeout(int timeout)
 				log_message(LOG_ERR, "cannot get timeout (errno = %d = '%s')", err, strerror(err));
 			} else {
 				log_message(LOG_INFO, "watchdog was set to %d seconds", timeout);
+				if (timeout > 0)
+					timeout_used = timeout;
 				rv = 0;
 			}
 		}
@@ -155,13 +206,76 @@ int set_watchdog_timeout(int timeout)
 	return rv;
 }
 
-/* write to the watchdog device */
-int keep_alive(void)
+/*
+ * Work out how long the hardware timer had left just before a refresh, in msec,
+ * or -1 if that is not known (first refresh with no WDIOC_GETTIMELEFT).
+ */
+
+static long time_left(const struct timespec *now)
+{
+	if (try_timeleft) {
+		int left = 0;
+
+		if (ioctl(watchdog_fd, WDIOC_GETTIMELEFT, &left) == 0) {
+			stats.hw_timeleft = TRUE;
+			return 1000L * left;
+		}
+
+		/* Most drivers don't have it, don't ask again. */
+		try_timeleft = FALSE;
+		stats.hw_timeleft = FALSE;
+		if (verbose) {
+			int err = errno;
+			log_message(LOG_DEBUG, "cannot get watchdog time left (errno = %d = '%s'), estimating it",
+				err, strerror(err));
+		}
+	}
+
+	if (last_refresh.tv_sec == 0 && last_refresh.tv_nsec == 0)
+		return -1;
+
+	return 1000L * timeout_used - ((now->tv_sec - last_refresh.tv_sec) * 1000L +
+		(now->tv_nsec - last_refresh.tv_nsec) / 1000000L);
+}
+
+/*
+ * Note the time left and the spacing of a successful refresh made at 'now'.
+ */
+
+static void record_refresh(const struct timespec *now, long margin)
+{
+	if (last_refresh.tv_sec != 0 || last_refresh.tv_nsec != 0) {
+		hist_add(&stats.spacing, (now->tv_sec - last_refresh.tv_sec) * 1000000L +
+			 (now->tv_nsec - last_refresh.tv_nsec) / 1000L);
+	}
+
+	stats.refreshes++;
+	stats.last_margin = margin;
+	if (margin < 0)
+		return;
+
+	if (stats.min_margin < 0 || margin < stats.min_margin)
+		stats.min_margin = margin;
+
+	if (margin < 10L * NEAR_MISS_PCT * timeout_used) {
+		stats.near_miss++;
+		log_message(LOG_WARNING, "watchdog refreshed with only %ldms of %ds left", margin, timeout_used);
+	}
+}
+
+/*
+ * Refresh the hardware timer and record the heartbeat. Called with 'refresh_lock'
+ * held.
+ */
+
+static int refresh_device(void)
 {
 	int err = ENOERR;
+	struct timespec now;
+	long margin;
 
-	if (watchdog_fd == -1)
-		return (ENOERR);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	margin = time_left(&now);
 
 	if (Refresh_using_ioctl) {
 		int timeout = timeout_used;
@@ -182,9 +296,258 @@ int keep_alive(void)
 	   - easier and quicker to parse checkpoint information */
 	write_heartbeat();
 
+	if (err == ENOERR)
+		record_refresh(&now, margin);
+
+	clock_gettime(CLOCK_MONOTONIC, &last_refresh);
+
+	return (err);
+}
+
+/*
+ * The minimum time between refreshes in milliseconds. This is never more than half
+ * the hardware time-out, so keep_alive() being called at least that often is
+ * enough to be safe.
+ */
+
+static long refresh_spacing(void)
+{
+	long limit = 500L * timeout_used;
+
+	return (ka_spacing < limit) ? ka_spacing : limit;
+}
+
+/*
+ * write to the watchdog device
+ *
+ * When the keep-alive thread is running this only tells it we are still making
+ * progress, and reports any error the thread had since the last call. Otherwise
+ * the device is only written if the last refresh was at least the refresh
+ * spacing ago.
+ */
+
+int keep_alive(void)
+{
+	int err = ENOERR;
+	struct timespec now;
+
+	if (watchdog_fd == -1)
+		return (ENOERR);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&refresh_lock);
+	if (last_call.tv_sec != 0 || last_call.tv_nsec != 0) {
+		hist_add(&call_spacing, (now.tv_sec - last_call.tv_sec) * 1000000L +
+			 (now.tv_nsec - last_call.tv_nsec) / 1000L);
+	}
+	last_call = now;
+	pthread_mutex_unlock(&refresh_lock);
+
+	if (ka_running) {
+		pthread_mutex_lock(&ka_lock);
+		progress++;
+		err = ka_error;
+		ka_error = ENOERR;
+		pthread_mutex_unlock(&ka_lock);
+		return (err);
+	}
+
+	pthread_mutex_lock(&refresh_lock);
+
+	if (last_refresh.tv_sec != 0 || last_refresh.tv_nsec != 0) {
+		long msec;
+
+		msec = (now.tv_sec - last_refresh.tv_sec) * 1000L + (now.tv_nsec - last_refresh.tv_nsec) / 1000000L;
+		if (msec < refresh_spacing()) {
+			pthread_mutex_unlock(&refresh_lock);
+			return (ENOERR);
+		}
+	}
+
+	err = refresh_device();
+	pthread_mutex_unlock(&refresh_lock);
+
 	return (err);
 }
 
+/*
+ * Report the latest time (CLOCK_MONOTONIC) keep_alive() has to be called by for
+ * the device to be refreshed in good time, which is half the hardware time-out
+ * after the last refresh. Returns -1 if there is nothing for the caller to do
+ * (no device open, or the keep-alive thread is looking after it).
+ */
+
+int keep_alive_deadline(struct timespec *when)
+{
+	if (watchdog_fd == -1 || ka_running)
+		return -1;
+
+	pthread_mutex_lock(&refresh_lock);
+	*when = last_refresh;
+	pthread_mutex_unlock(&refresh_lock);
+
+	when->tv_sec += timeout_used / 2;
+	when->tv_nsec += (timeout_used % 2) * 500000000L;
+	if (when->tv_nsec >= 1000000000L) {
+		when->tv_sec++;
+		when->tv_nsec -= 1000000000L;
+	}
+
+	return 0;
+}
+
+/*
+ * The keep-alive thread. Every 'tint' seconds (on an absolute deadline) check that
+ * the main loop has advanced its progress count within the last 'stale_limit'
+ * seconds and, if so, refresh the device. If the checker is hung we stop, and the
+ * hardware timer will then reset the machine.
+ */
+
+static void *keepalive_thread(void *arg)
+{
+	struct timespec next, last_seen;
+	unsigned long last_progress;
+	int stalled = FALSE;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	last_seen = next;
+	last_progress = progress;
+
+	while (ka_running) {
+		unsigned long now_progress;
+		struct timespec now;
+		int err;
+
+		pthread_mutex_lock(&ka_lock);
+		now_progress = progress;
+		pthread_mutex_unlock(&ka_lock);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now_progress != last_progress) {
+			last_progress = now_progress;
+			last_seen = now;
+		}
+
+		if (now.tv_sec - last_seen.tv_sec <= stale_limit) {
+			if (stalled) {
+				log_message(LOG_WARNING, "checker running again, watchdog refresh resumed");
+				stalled = FALSE;
+			}
+
+			pthread_mutex_lock(&refresh_lock);
+			err = refresh_device();
+			pthread_mutex_unlock(&refresh_lock);
+			if (err != ENOERR) {
+				pthread_mutex_lock(&ka_lock);
+				ka_error = err;
+				pthread_mutex_unlock(&ka_lock);
+			}
+		} else if (!stalled) {
+			log_message(LOG_ALERT, "no checker progress for %d seconds, watchdog no longer refreshed",
+				(int)(now.tv_sec - last_seen.tv_sec));
+			stalled = TRUE;
+		}
+
+		next.tv_sec += tint;
+		pthread_mutex_lock(&ka_lock);
+		while (ka_running && pthread_cond_timedwait(&ka_cond, &ka_lock, &next) == 0) {
+			/* Woken early, only matters if we are being stopped. */
+		}
+		pthread_mutex_unlock(&ka_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start the keep-alive thread, 'stale' is the time in seconds the checker may
+ * go without calling keep_alive() before we stop refreshing the device. If the
+ * process is using real-time scheduling the thread runs at 'priority' so the
+ * refresh does not depend on how busy the checks are.
+ */
+
+int start_keepalive_thread(int stale, int priority)
+{
+	pthread_condattr_t attr;
+	int err;
+
+	if (watchdog_fd == -1 || ka_running)
+		return -1;
+
+	stale_limit = (stale > 0) ? stale : 1;
+	progress = 0;
+	ka_error = ENOERR;
+
+	/* The thread waits on an absolute CLOCK_MONOTONIC time so it does not drift. */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ka_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* Refresh now so the thread starts with a full period. */
+	pthread_mutex_lock(&refresh_lock);
+	refresh_device();
+	pthread_mutex_unlock(&refresh_lock);
+
+	ka_running = TRUE;
+	err = pthread_create(&ka_thread, NULL, keepalive_thread, NULL);
+	if (err) {
+		ka_running = FALSE;
+		log_message(LOG_ERR, "cannot start keep-alive thread (errno = %d = '%s')", err, strerror(err));
+		return -1;
+	}
+
+	if (realtime) {
+		struct sched_param sp;
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = priority;
+		err = pthread_setschedparam(ka_thread, SCHED_RR, &sp);
+		if (err) {
+			log_message(LOG_ERR, "cannot set keep-alive thread scheduler (errno = %d = '%s')", err, strerror(err));
+		}
+	}
+
+	log_message(LOG_INFO, "keep-alive thread started (stale limit %d seconds)", stale_limit);
+	return 0;
+}
+
+/*
+ * Stop the keep-alive thread (if running) so keep_alive() goes back to refreshing
+ * the device directly, as needed for shut-down or closing the device.
+ */
+
+int stop_keepalive_thread(void)
+{
+	if (!ka_running)
+		return -1;
+
+	pthread_mutex_lock(&ka_lock);
+	ka_running = FALSE;
+	pthread_cond_signal(&ka_cond);
+	pthread_mutex_unlock(&ka_lock);
+	pthread_join(ka_thread, NULL);
+	pthread_cond_destroy(&ka_cond);
+
+	return 0;
+}
+
+/*
+ * Reopen the heartbeat file with the current settings. The keep-alive thread (or a
+ * check worker) writes the heartbeat from refresh_device(), so the old file must not
+ * be closed under it.
+ */
+
+int reopen_heartbeat(void)
+{
+	int rv;
+
+	pthread_mutex_lock(&refresh_lock);
+	rv = open_heartbeat();
+	pthread_mutex_unlock(&refresh_lock);
+
+	return rv;
+}
+
 /*
  * Provide read-only access to the watchdog file handle.
  */
@@ -194,6 +557,57 @@ int get_watchdog_fd(void)
 	return watchdog_fd;
 }
 
+/*
+ * Copy the histogram of the time between keep_alive() calls in to 'h'.
+ */
+
+void keep_alive_spacing(struct histogram *h)
+{
+	pthread_mutex_lock(&refresh_lock);
+	*h = call_spacing;
+	pthread_mutex_unlock(&refresh_lock);
+}
+
+/*
+ * Copy the refresh timing in to 'st'.
+ */
+
+void keep_alive_stats(struct ka_stats *st)
+{
+	pthread_mutex_lock(&refresh_lock);
+	*st = stats;
+	pthread_mutex_unlock(&refresh_lock);
+}
+
+/*
+ * Log a summary of the refresh timing, for sizing 'interval' and 'watchdog-timeout'.
+ */
+
+void log_keep_alive_stats(void)
+{
+	struct ka_stats st;
+
+	if (watchdog_fd == -1)
+		return;
+
+	keep_alive_stats(&st);
+	if (st.refreshes == 0)
+		return;
+
+	log_message(LOG_INFO, "keep-alive: %lu refreshes, spacing p99 %lums max %lums, least time left %ldms%s, %lu near miss(es)",
+		st.refreshes, hist_percentile(&st.spacing, 99) / 1000, st.spacing.max / 1000, st.min_margin,
+		st.hw_timeleft ? "" : " (estimated)", st.near_miss);
+}
+
+/*
+ * The hardware time-out in seconds, as set or read back from the device.
+ */
+
+int get_watchdog_timeout(void)
+{
+	return timeout_used;
+}
+
 /*
  * Close the watchdog device, this normally stops the hardware timer to prevent a
  * spontaneous reboot, but not if the kernel is compiled with the
@@ -204,6 +618,8 @@ int close_watchdog(void)
 {
 	int rv = 0;
 
+	stop_keepalive_thread();
+
 	if (watchdog_fd != -1) {
 		if (write(watchdog_fd, "V", 1) < 0) {
 			int err = errno;
@@ -219,6 +635,7 @@ int close_watchdog(void)
 	}
 
 	watchdog_fd = -1;
+	memset(&last_refresh, 0, sizeof(last_refresh));
 
 	return rv;
 }
@@ -209,14 +209,13 @@ static int get_ID(pid_t pid, PROC *p)
 		char *s = strrchr(buf, ')');
 
 		if (s != NULL) {
-			char state=0;
-			int parent=0, pgroup=0, session=0;
+			long vals[3];	/* ppid, pgrp and session. */
 
-			s++; /* Skip past the ')' character to read the state/ppid/pgrp/session data. */
+			s++; /* Skip past the ')' character, then the state, to read the ppid/pgrp/session data. */
 
-			if (sscanf(s, " %c %d %d %d", &state, &parent, &pgroup, &session) == 4) {
-				p->sid = session;
-				p->ppid = (pid_t)parent;
+			if (proc_columns(s, 1, vals, 3) == 3) {
+				p->sid = (int)vals[2];
+				p->ppid = (pid_t)vals[0];
 				rv = 0;
 			}
 		}
@@ -18,8 +18,8 @@
 #include "extern.h"
 #include "watch_err.h"
 
-static int load_fd = -1;
-static const char load_name[] = "/proc/loadavg";
+static char load_buf[128];
+static struct proc_file load_file = PROC_FILE("/proc/loadavg", load_buf);
 
 /* ============================================================================ */
 
@@ -31,12 +31,7 @@ int open_loadcheck(void)
 
 	if (maxload1 || maxload5 || maxload15) {
 		/* open the load average file */
-		load_fd = open(load_name, O_RDONLY);
-		if (load_fd == -1) {
-			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", load_name, errno, strerror(errno));
-		} else {
-			rv = 0;
-		}
+		rv = proc_open(&load_file);
 	}
 
 	return rv;
@@ -47,46 +42,28 @@ int open_loadcheck(void)
 int check_load(void)
 {
 	int avg1, avg5, avg15;
-	char buf[40], *ptr;
-	int n;
+	const char *buf;
+	long vals[3];
+	int err;
 
 	/* is the load average file open? */
-	if (load_fd == -1)
+	if (load_file.fd == -1)
 		return (ENOERR);
 
-	/* position pointer at start of file */
-	if (lseek(load_fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", load_name, err, strerror(err));
-		return (err);
-	}
-
 	/* read the line (there is only one) */
-	if ((n = read(load_fd, buf, sizeof(buf)-1)) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", load_name, err, strerror(err));
+	if ((err = proc_read(&load_file, &buf)) != ENOERR)
 		return (err);
-	}
-	/* Force string to be nul-terminated. */
-	buf[n] = 0;
-	/* we only care about integer values */
-	avg1 = atoi(buf);
-
-	/* if we have incorrect data we might not be able to find */
-	/* the blanks we're looking for */
-	ptr = strchr(buf, ' ');
-	if (ptr != NULL) {
-		avg5 = atoi(ptr);
-		ptr = strchr(ptr + 1, ' ');
-	}
 
-	if (ptr != NULL) {
-		avg15 = atoi(ptr);
-	} else {
-		log_message(LOG_ERR, "%s does not contain any data (read = %s)", load_name, buf);
+	/* we only care about integer values */
+	if (proc_columns(buf, 0, vals, 3) != 3) {
+		log_message(LOG_ERR, "%s does not contain any data (read = %s)", load_file.name, buf);
 		return (ENOLOAD);
 	}
 
+	avg1 = vals[0];
+	avg5 = vals[1];
+	avg15 = vals[2];
+
 	if (verbose && logtick && ticker == 1)
 		log_message(LOG_DEBUG, "current load is %d %d %d", avg1, avg5, avg15);
 
@@ -108,14 +85,5 @@ int check_load(void)
 
 int close_loadcheck(void)
 {
-	int rv = -1;
-
-	if (load_fd != -1 && close(load_fd) == -1) {
-		log_message(LOG_ALERT, "cannot close %s (errno = %d)", load_name, errno);
-	} else {
-		rv = 0;
-	}
-
-	load_fd = -1;
-	return rv;
+	return proc_close(&load_file);
 }
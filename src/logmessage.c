@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "logmessage.h"
 
@@ -35,6 +36,30 @@ static int  err_count = 0;
 static int  err_level = LOG_DEBUG;
 static char err_buf[MAX_MESSAGE];
 
+/*
+ * Messages can come from the keep-alive thread and the check workers, so output
+ * is done under a lock. It is also held across fork() so a child process can't
+ * start life with the lock taken by some other thread, and hang on its first
+ * message.
+ */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+static void lock_for_fork(void)
+{
+	pthread_mutex_lock(&log_lock);
+}
+
+static void unlock_after_fork(void)
+{
+	pthread_mutex_unlock(&log_lock);
+}
+
+static void init_lock(void)
+{
+	pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
+}
+
 /*
  * Prepare for message printing.
  *
@@ -49,6 +74,8 @@ int open_logging(const char *name, int flags)
 {
 	int rv = 0;
 
+	pthread_once(&log_once, init_lock);
+
 	if (name != NULL)
 		strncpy(progname, name, sizeof(progname) - 1);
 
@@ -80,6 +107,8 @@ static int output_message(int level, char *buf)
 	FILE *fp = stderr;
 	int rv = 0;
 
+	pthread_mutex_lock(&log_lock);
+
 #if USE_SYSLOG
 	if (using_syslog && err_count == 0) {
 		syslog(level, "%s", buf);
@@ -104,6 +133,8 @@ static int output_message(int level, char *buf)
 		}
 	}
 
+	pthread_mutex_unlock(&log_lock);
+
 	return rv;
 }
 
@@ -28,11 +28,10 @@
 #include "extern.h"
 #include "watch_err.h"
 
-#define FREEMEM		"MemFree:"
-#define FREESWAP	"SwapFree:"
+static char mem_buf[4096];
+static struct proc_file mem_file = PROC_FILE("/proc/meminfo", mem_buf);
 
-static int mem_fd = -1;
-static const char mem_name[] = "/proc/meminfo";
+static const char *const mem_keys[] = { "MemFree", "SwapFree" };
 
 /*
  * Open the memory information file if such as test is configured.
@@ -46,13 +45,7 @@ int open_memcheck(void)
 
 	if (minpages > 0) {
 		/* open the memory info file */
-		mem_fd = open(mem_name, O_RDONLY);
-		if (mem_fd == -1) {
-			int err = errno;
-			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", mem_name, err, strerror(err));
-		} else {
-			rv = 0;
-		}
+		rv = proc_open(&mem_file);
 	}
 
 	return rv;
@@ -64,48 +57,32 @@ int open_memcheck(void)
 
 int check_memory(void)
 {
-	char buf[1024], *ptr1, *ptr2;
-	unsigned int free, freemem, freeswap;
-	int n;
+	const char *buf;
+	long vals[2];
+	unsigned long free, freemem, freeswap;
+	int err;
 
 	/* is the memory file open? */
-	if (mem_fd == -1)
+	if (mem_file.fd == -1)
 		return (ENOERR);
 
-	/* position pointer at start of file */
-	if (lseek(mem_fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", mem_name, err, strerror(err));
+	if ((err = proc_read(&mem_file, &buf)) != ENOERR)
 		return (err);
-	}
-
-	/* read the file */
-	if ((n = read(mem_fd, buf, sizeof(buf)-1)) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", mem_name, err, strerror(err));
-		return (err);
-	}
-	/* Force string to be nul-terminated. */
-	buf[n] = 0;
-
-	ptr1 = strstr(buf, FREEMEM);
-	ptr2 = strstr(buf, FREESWAP);
 
-	if (!ptr1 || !ptr2) {
-		log_message(LOG_ERR, "%s contains invalid data (read = %s)", mem_name, buf);
+	if (proc_keys(buf, mem_keys, vals, 2) != 2) {
+		log_message(LOG_ERR, "%s contains invalid data (read = %s)", mem_file.name, buf);
 		return (EINVMEM);
 	}
 
-	/* we only care about integer values */
-	freemem  = atoi(ptr1 + strlen(FREEMEM));
-	freeswap = atoi(ptr2 + strlen(FREESWAP));
+	freemem  = vals[0];
+	freeswap = vals[1];
 	free = freemem + freeswap;
 
 	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "currently there are %u + %u kB of free memory+swap available", freemem, freeswap);
+		log_message(LOG_DEBUG, "currently there are %lu + %lu kB of free memory+swap available", freemem, freeswap);
 
 	if (free < minpages * (EXEC_PAGESIZE / 1024)) {
-		log_message(LOG_ERR, "memory %d kB is less than %d pages", free, minpages);
+		log_message(LOG_ERR, "memory %lu kB is less than %d pages", free, minpages);
 		return (ENOMEM);
 	}
 
@@ -118,15 +95,7 @@ int check_memory(void)
 
 int close_memcheck(void)
 {
-	int rv = 0;
-
-	if (mem_fd != -1 && close(mem_fd) == -1) {
-		log_message(LOG_ALERT, "cannot close %s (errno = %d)", mem_name, errno);
-		rv = -1;
-	}
-
-	mem_fd = -1;
-	return rv;
+	return proc_close(&mem_file);
 }
 
 int check_allocatable(void)
@@ -0,0 +1,370 @@
+/* > metrics.c
+ *
+ * Serve the daemon's counters and histograms in the Prometheus text format, as
+ * a minimal HTTP/1.0 server on a local Unix socket. For example:
+ *
+ *	curl --unix-socket /run/watchdog.metrics http://localhost/metrics
+ *
+ * The socket is served by unix_server.c from the main loop's event set, so
+ * nothing blocks. The page is rendered into a buffer allocated at start-up,
+ * sized for the configured checks, so a scrape never allocates memory.
+ * Per-check values come from the stats.c snapshot taken at the end of each pass.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "extern.h"
+#include "watch_err.h"
+#include "stats.h"
+
+#define MAX_CLIENTS	8
+#define PAGE_BASE	(64 * 1024)	/* Page size for the global metrics... */
+#define PAGE_ENTRY	1536		/* ...plus this much for each check. */
+
+static int request_complete(const char *in);
+static void respond(struct server_client *c);
+static void release_page(struct server_client *c);
+
+static struct unix_server server = {
+	.what = "metrics",
+	.max_clients = MAX_CLIENTS,
+	.complete = request_complete,
+	.respond = respond,
+	.release = release_page,
+};
+
+static int page_writers = 0;	/* Clients still being sent 'page', which must not change meanwhile. */
+
+static char *page = NULL;
+static size_t page_size = 0;
+static size_t page_len = 0;
+static int page_full = FALSE;
+static int page_full_logged = FALSE;
+
+/* Counters kept from start-up. */
+static unsigned long failures[256];	/* Failed checks by error code. */
+static unsigned long repairs = 0;
+static unsigned long repair_failures = 0;
+
+/* Histogram owned by the main loop, those of each kind of check are in check_types[]. */
+static const struct histogram *loop_hist = NULL;
+
+/* Cumulative bucket limits for exported histograms, in usec. */
+static const unsigned long le_us[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static const char http_ok[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+static const char http_bad[] = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n";
+
+/*
+ * Append to the page, stopping (and remembering) once it is full.
+ */
+
+static void out(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (page_full)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(page + page_len, page_size - page_len, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || (size_t)len >= page_size - page_len) {
+		page[page_len] = '\0';
+		page_full = TRUE;
+		return;
+	}
+
+	page_len += len;
+}
+
+/*
+ * Copy 's' into 'buf' as a label value, with '\', '"' and new-line escaped.
+ */
+
+static const char *label(char *buf, size_t size, const char *s)
+{
+	size_t ii = 0;
+
+	for (; *s && ii + 2 < size; s++) {
+		if (*s == '\\' || *s == '"') {
+			buf[ii++] = '\\';
+			buf[ii++] = *s;
+		} else if (*s == '\n') {
+			buf[ii++] = '\\';
+			buf[ii++] = 'n';
+		} else {
+			buf[ii++] = *s;
+		}
+	}
+
+	buf[ii] = '\0';
+	return buf;
+}
+
+static void family(const char *name, const char *type, const char *help)
+{
+	out("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Write 'h' (in usec) as a histogram in seconds, 'labels' being any labels
+ * without their braces or an empty string.
+ */
+
+static void put_histogram(const char *name, const char *labels, const struct histogram *h)
+{
+	const char *sep = (*labels) ? "," : "";
+	int ii;
+
+	for (ii = 0; ii < (int)(sizeof(le_us) / sizeof(le_us[0])); ii++)
+		out("%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, sep, le_us[ii] / 1e6, hist_count_below(h, le_us[ii]));
+
+	out("%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, h->count);
+	if (*labels) {
+		out("%s_sum{%s} %.6f\n", name, labels, h->sum / 1e6);
+		out("%s_count{%s} %lu\n", name, labels, h->count);
+	} else {
+		out("%s_sum %.6f\n", name, h->sum / 1e6);
+		out("%s_count %lu\n", name, h->count);
+	}
+}
+
+/*
+ * One sample per check for each of the per-check families.
+ */
+
+static void put_entries(const struct ws_header *hdr)
+{
+	const struct ws_entry *ent = (const struct ws_entry *)(hdr + 1);
+	char name[2 * WS_NAME_LEN];
+	uint32_t ii;
+
+	family("watchdog_checks_total", "counter", "Checks run.");
+	for (ii = 0; ii < hdr->nentries; ii++)
+		out("watchdog_checks_total{kind=\"%s\",name=\"%s\"} %llu\n", ent[ii].kind,
+		    label(name, sizeof(name), ent[ii].name), (unsigned long long)ent[ii].checks);
+
+	family("watchdog_check_errors_total", "counter", "Checks that did not pass.");
+	for (ii = 0; ii < hdr->nentries; ii++)
+		out("watchdog_check_errors_total{kind=\"%s\",name=\"%s\"} %llu\n", ent[ii].kind,
+		    label(name, sizeof(name), ent[ii].name), (unsigned long long)ent[ii].errors);
+
+	family("watchdog_check_last_result", "gauge", "Error code of the latest check, 0 if it passed.");
+	for (ii = 0; ii < hdr->nentries; ii++)
+		out("watchdog_check_last_result{kind=\"%s\",name=\"%s\"} %d\n", ent[ii].kind,
+		    label(name, sizeof(name), ent[ii].name), ent[ii].last_result);
+
+	family("watchdog_check_last_duration_seconds", "gauge", "Time the latest check took.");
+	for (ii = 0; ii < hdr->nentries; ii++)
+		out("watchdog_check_last_duration_seconds{kind=\"%s\",name=\"%s\"} %.6f\n", ent[ii].kind,
+		    label(name, sizeof(name), ent[ii].name), ent[ii].last_latency_us / 1e6);
+
+	family("watchdog_check_repair_count", "gauge", "Repair attempts since the check last passed.");
+	for (ii = 0; ii < hdr->nentries; ii++)
+		out("watchdog_check_repair_count{kind=\"%s\",name=\"%s\"} %d\n", ent[ii].kind,
+		    label(name, sizeof(name), ent[ii].name), ent[ii].repair_count);
+
+	family("watchdog_ping_rtt_seconds", "gauge", "Smoothed ping round trip time.");
+	for (ii = 0; ii < hdr->nentries; ii++) {
+		if (ent[ii].rtt_us >= 0)
+			out("watchdog_ping_rtt_seconds{name=\"%s\"} %.6f\n",
+			    label(name, sizeof(name), ent[ii].name), ent[ii].rtt_us / 1e6);
+	}
+
+	family("watchdog_ping_rtt_variation_seconds", "gauge", "Ping round trip time variation.");
+	for (ii = 0; ii < hdr->nentries; ii++) {
+		if (ent[ii].rtt_us >= 0)
+			out("watchdog_ping_rtt_variation_seconds{name=\"%s\"} %.6f\n",
+			    label(name, sizeof(name), ent[ii].name), ent[ii].rttvar_us / 1e6);
+	}
+
+	family("watchdog_ping_lost", "gauge", "Pings lost out of those recently sent.");
+	for (ii = 0; ii < hdr->nentries; ii++) {
+		if (strcmp(ent[ii].kind, "ping") == 0)
+			out("watchdog_ping_lost{name=\"%s\"} %u\n", label(name, sizeof(name), ent[ii].name), ent[ii].lost);
+	}
+
+	family("watchdog_ping_sent", "gauge", "Pings the loss is counted over.");
+	for (ii = 0; ii < hdr->nentries; ii++) {
+		if (strcmp(ent[ii].kind, "ping") == 0)
+			out("watchdog_ping_sent{name=\"%s\"} %u\n", label(name, sizeof(name), ent[ii].name), ent[ii].sent);
+	}
+}
+
+/*
+ * Render the whole page, HTTP header included.
+ */
+
+static void render(void)
+{
+	const struct ws_header *hdr = stats_snapshot();
+	struct histogram spacing;
+	struct ka_stats ka;
+	char labels[64];
+	int ii;
+
+	page_len = 0;
+	page_full = FALSE;
+	out("%s", http_ok);
+
+	if (hdr != NULL) {
+		family("watchdog_start_time_seconds", "gauge", "Time the daemon started, since the epoch.");
+		out("watchdog_start_time_seconds %lld\n", (long long)hdr->started);
+		family("watchdog_loops_total", "counter", "Passes of the main loop.");
+		out("watchdog_loops_total %llu\n", (unsigned long long)hdr->loops);
+	}
+
+	family("watchdog_check_failures_total", "counter", "Failed checks by error code.");
+	for (ii = 0; ii < 256; ii++) {
+		if (failures[ii] > 0)
+			out("watchdog_check_failures_total{code=\"%d\",error=\"%s\"} %lu\n", ii,
+			    label(labels, sizeof(labels), wd_strerror(ii)), failures[ii]);
+	}
+
+	family("watchdog_repairs_total", "counter", "Repair binary runs.");
+	out("watchdog_repairs_total %lu\n", repairs);
+	family("watchdog_repair_failures_total", "counter", "Repair binary runs that did not fix the problem.");
+	out("watchdog_repair_failures_total %lu\n", repair_failures);
+
+	keep_alive_stats(&ka);
+	family("watchdog_refreshes_total", "counter", "Refreshes of the watchdog device.");
+	out("watchdog_refreshes_total %lu\n", ka.refreshes);
+	family("watchdog_refresh_near_misses_total", "counter", "Refreshes with under a quarter of the time-out left.");
+	out("watchdog_refresh_near_misses_total %lu\n", ka.near_miss);
+	if (ka.last_margin >= 0) {
+		family("watchdog_time_left_seconds", "gauge", "Time left on the watchdog device at the latest refresh.");
+		out("watchdog_time_left_seconds %.3f\n", ka.last_margin / 1e3);
+		family("watchdog_min_time_left_seconds", "gauge", "Least time left on the watchdog device at a refresh.");
+		out("watchdog_min_time_left_seconds %.3f\n", ka.min_margin / 1e3);
+	}
+
+	if (loop_hist != NULL) {
+		family("watchdog_loop_duration_seconds", "histogram", "Time taken by each pass of the main loop.");
+		put_histogram("watchdog_loop_duration_seconds", "", loop_hist);
+	}
+
+	family("watchdog_refresh_spacing_seconds", "histogram", "Time between refreshes of the watchdog device.");
+	put_histogram("watchdog_refresh_spacing_seconds", "", &ka.spacing);
+
+	keep_alive_spacing(&spacing);
+	family("watchdog_keepalive_spacing_seconds", "histogram", "Time between keep-alive calls from the checks.");
+	put_histogram("watchdog_keepalive_spacing_seconds", "", &spacing);
+
+	family("watchdog_check_duration_seconds", "histogram", "Time taken by checks of each kind.");
+	for (ii = 0; ii < CHECK_TYPES; ii++) {
+		if (check_types[ii].latency.count > 0) {
+			snprintf(labels, sizeof(labels), "kind=\"%s\"", check_types[ii].name);
+			put_histogram("watchdog_check_duration_seconds", labels, &check_types[ii].latency);
+		}
+	}
+
+	if (hdr != NULL)
+		put_entries(hdr);
+
+	if (page_full && !page_full_logged) {
+		log_message(LOG_WARNING, "metrics page is larger than %lu bytes, output truncated", (unsigned long)page_size);
+		page_full_logged = TRUE;
+	}
+}
+
+/* Wait for the end of the request headers (or of the request). */
+static int request_complete(const char *in)
+{
+	return (strstr(in, "\r\n\r\n") != NULL || strstr(in, "\n\n") != NULL);
+}
+
+static void respond(struct server_client *c)
+{
+	if (strncmp(c->in, "GET ", 4) == 0) {
+		/* Anyone still being sent the page gets it unchanged, so share it. */
+		if (page_writers == 0)
+			render();
+		c->out = page;
+		c->out_len = page_len;
+		page_writers++;
+	} else {
+		c->out = http_bad;
+		c->out_len = sizeof(http_bad) - 1;
+	}
+}
+
+static void release_page(struct server_client *c)
+{
+	if (c->out == page)
+		page_writers--;
+}
+
+/*
+ * Create the socket named by 'metrics_socket' and serve it from the event loop.
+ * 'loop' is the main loop's histogram of the time taken by each pass.
+ */
+
+int open_metrics(const struct histogram *loop)
+{
+	const struct ws_header *hdr = stats_snapshot();
+
+	close_metrics();
+
+	if (metrics_socket == NULL)
+		return 0;
+
+	if (server_open(&server, metrics_socket) < 0)
+		return -1;
+
+	page_size = PAGE_BASE + ((hdr != NULL) ? hdr->nentries : 0) * PAGE_ENTRY;
+	page = (char *)xcalloc(1, page_size);
+	page_len = 0;
+	page_writers = 0;
+	page_full_logged = FALSE;
+
+	loop_hist = loop;
+
+	log_message(LOG_INFO, "serving metrics on %s", metrics_socket);
+	return 0;
+}
+
+/*
+ * Count a failed check by its error code.
+ */
+
+void metrics_check_failed(int err)
+{
+	failures[err & 0xff]++;
+}
+
+/*
+ * Count a run of the repair binary and whether it fixed the problem.
+ */
+
+void metrics_repair(int result)
+{
+	repairs++;
+	if (result != ENOERR)
+		repair_failures++;
+}
+
+int close_metrics(void)
+{
+	if (server_close(&server) < 0)
+		return -1;
+
+	free(page);
+	page = NULL;
+	page_size = page_len = 0;
+
+	return 0;
+}
@@ -3,6 +3,9 @@
  * Code for checking network access. The open_netcheck() function is from set-up
  * code originally in watchdog.c
  *
+ * Both IPv4 (ICMP) and IPv6 (ICMPv6) targets are supported, each address family
+ * has one socket shared by all of its targets.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
@@ -13,6 +16,7 @@
 #include <sys/time.h>
 #include <netinet/ip.h>
 #include <linux/icmp.h>
+#include <netinet/icmp6.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>		/* for gethostname() etc */
@@ -22,6 +26,11 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>		/* for ldiv() */
+#include <sys/epoll.h>		/* for EPOLLIN */
+#include <poll.h>
+#include <time.h>
+#include <linux/net_tstamp.h>	/* for SOF_TIMESTAMPING_* */
+#include <linux/errqueue.h>	/* for struct sock_extended_err */
 
 #ifndef FD_CLOEXEC
 #define FD_CLOEXEC 1
@@ -61,150 +70,847 @@ static int in_cksum(unsigned short *addr, int len)
 	return (answer);
 }
 
+#define MAX_PINGCOUNT	100	/* Matches the 'ping-count' limit in configfile.c */
+
+/*
+ * All targets of an address family share one ICMP socket, so the kernel makes
+ * one copy of each echo reply for us rather than one per target. Replies are
+ * matched back to their target through a small open-addressing hash table keyed
+ * on the address and sequence number of every echo request sent in this round.
+ */
+
+struct reply_slot {
+	struct list *act;
+	unsigned int round;		/* Slot is in use if this matches reply_round. */
+	unsigned short seq;
+	struct timespec tx;		/* When sent, CLOCK_REALTIME to match the kernel's time stamps. */
+};
+
+/*
+ * If 'dgram' is set the socket is an unprivileged SOCK_DGRAM ICMP socket. The
+ * kernel then fills in the echo ID and checksum, only passes us replies carrying
+ * our ID, and strips the IP header. Otherwise it is a raw socket that sees every
+ * echo reply the host receives.
+ *
+ * Replies carry a kernel receive time stamp (SO_TIMESTAMPNS), and if 'tx_stamp'
+ * is set the kernel also reports when each request actually left, on the error
+ * queue (SO_TIMESTAMPING). Those reports are identified only by a count of the
+ * packets sent on the socket, so 'tx_slot' maps that count back to the reply
+ * table for this round. The count is reset at the start of each round, and if
+ * a send fails we can no longer be sure of it so 'tx_sync' is cleared and the
+ * rest of the round uses our own send times.
+ *
+ * A raw socket also gets a BPF filter (see ping_filter.c) so the kernel drops
+ * other people's echo replies. It is built once our process ID, which is the
+ * echo identifier, is known; 'filter_id' is the identifier it was built for.
+ */
+
+struct icmp_sock {
+	int family;
+	const char *pname;		/* Protocol name for getprotobyname(). */
+	int fd;
+	int dgram;
+	int num;			/* Number of targets using this socket. */
+	int tx_stamp;
+	int tx_sync;
+	unsigned int tx_next;		/* Count the kernel will give the next send. */
+	unsigned int *tx_slot;		/* Reply table index for each count, reply_mask+1 entries. */
+	int filter_id;
+};
+
+#define NUM_ICMP	2
+
+static struct icmp_sock icmp_socks[NUM_ICMP] = {
+	{AF_INET, "icmp", -1, 0, 0, 0, 0, 0, NULL, -1},
+	{AF_INET6, "ipv6-icmp", -1, 0, 0, 0, 0, 0, NULL, -1},
+};
+
+#define TX_STAMP_FLAGS	(SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | \
+			 SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY)
+
+/* Control message space for the time stamps and error queue reports. */
+static unsigned char icmp_control[512];
+
+static unsigned char icmp_packet[PKBUF_SIZE];
+
+/* Sequence number of the last echo request, shared by all targets. */
+static unsigned short ping_seq = 0;
+
+/* All the targets, as given to open_netcheck(). */
+static struct list *ping_list = NULL;
+
+static struct reply_slot *reply_tab = NULL;
+static unsigned int reply_mask = 0;
+static unsigned int reply_round = 0;
+
+static struct icmp_sock *family_sock(int family)
+{
+	return &icmp_socks[(family == AF_INET6) ? 1 : 0];
+}
+
+static socklen_t family_len(int family)
+{
+	return (family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+/*
+ * Current CLOCK_MONOTONIC time as a timeval, for the reply deadlines which must
+ * not move if the wall clock is stepped.
+ */
+
+static void mono_now(struct timeval *tv)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+static unsigned int reply_hash(const struct sockaddr_storage *addr, unsigned short seq)
+{
+	unsigned int h;
+
+	if (addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+		unsigned int w[4];
+
+		memcpy(w, &in6->sin6_addr, sizeof(w));
+		h = ntohl(w[0] ^ w[1] ^ w[2] ^ w[3]);
+	} else {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+		h = ntohl(in->sin_addr.s_addr);
+	}
+
+	/* Fibonacci hashing to spread consecutive addresses over the table. */
+	return ((h ^ ((unsigned int)seq << 16)) * 2654435769U) >> 7;
+}
+
+static int same_addr(const struct sockaddr_storage *a, const struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+		return 0;
+
+	if (a->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6a = (const struct sockaddr_in6 *)a;
+		const struct sockaddr_in6 *in6b = (const struct sockaddr_in6 *)b;
+		return memcmp(&in6a->sin6_addr, &in6b->sin6_addr, sizeof(struct in6_addr)) == 0;
+	} else {
+		const struct sockaddr_in *ina = (const struct sockaddr_in *)a;
+		const struct sockaddr_in *inb = (const struct sockaddr_in *)b;
+		return ina->sin_addr.s_addr == inb->sin_addr.s_addr;
+	}
+}
+
+/*
+ * Empty the table for a new round, making sure it can hold 'entries' requests
+ * while staying no more than half full.
+ */
+
+static void reply_reset(int entries)
+{
+	unsigned int size = 64;
+
+	while (size < 2U * entries)
+		size <<= 1;
+
+	if (size > reply_mask + 1 || reply_tab == NULL) {
+		int ii;
+
+		free(reply_tab);
+		reply_tab = (struct reply_slot *)xcalloc(size, sizeof(struct reply_slot));
+		reply_mask = size - 1;
+		reply_round = 0;
+
+		for (ii = 0; ii < NUM_ICMP; ii++) {
+			free(icmp_socks[ii].tx_slot);
+			icmp_socks[ii].tx_slot = (unsigned int *)xcalloc(size, sizeof(unsigned int));
+		}
+	}
+
+	if (++reply_round == 0) {
+		/* Wrapped, clear the old marks so they can't match by accident. */
+		memset(reply_tab, 0, (reply_mask + 1) * sizeof(struct reply_slot));
+		reply_round = 1;
+	}
+}
+
+static unsigned int reply_add(struct list *act, unsigned short seq)
+{
+	unsigned int ii = reply_hash(&act->parameter.net.to, seq) & reply_mask;
+
+	while (reply_tab[ii].round == reply_round)
+		ii = (ii + 1) & reply_mask;
+
+	reply_tab[ii].act = act;
+	reply_tab[ii].seq = seq;
+	reply_tab[ii].round = reply_round;
+
+	return ii;
+}
+
+/*
+ * Per-target statistics. Every echo request sent adds a bit to the target's loss
+ * history that is cleared again when the reply comes in, and each reply gives a
+ * round trip time sample that is smoothed as for the TCP retransmission timer
+ * (RFC 6298). As each request has its own sequence number the samples are never
+ * ambiguous, even for retries. A negative 'rtt' means there is no usable sample.
+ */
+
+static void ping_sent(struct pingmode *net, unsigned short seq)
+{
+	net->lost = (net->lost << 1) | 1;
+	if (net->nsent < 64)
+		net->nsent++;
+	net->last_seq = seq;
+}
+
+static void ping_answered(struct pingmode *net, unsigned short seq, long rtt)
+{
+	unsigned short age = net->last_seq - seq;
+
+	if (age < 64)
+		net->lost &= ~(1ULL << age);
+
+	if (rtt < 0)
+		return;
+
+	if (rtt < 1)
+		rtt = 1;
+
+	if (net->srtt == 0) {
+		net->srtt = rtt;
+		net->rttvar = rtt / 2;
+	} else {
+		long delta = labs(net->srtt - rtt);
+		net->rttvar = (3 * net->rttvar + delta) / 4;
+		net->srtt = (7 * net->srtt + rtt) / 8;
+	}
+}
+
+/*
+ * Return the percentage of the last 'ping_window' requests that were lost, or -1
+ * if we have not sent that many yet.
+ */
+
+static int ping_loss(const struct pingmode *net)
+{
+	unsigned long long bits = net->lost;
+	int nlost = 0;
+
+	if (net->nsent < ping_window)
+		return -1;
+
+	if (ping_window < 64)
+		bits &= (1ULL << ping_window) - 1;
+
+	for (; bits != 0; bits &= bits - 1)
+		nlost++;
+
+	return (100 * nlost) / ping_window;
+}
+
+/*
+ * Retransmission time-out for a target in usec, or 'tmax' if we have no RTT
+ * sample yet.
+ */
+
+static long ping_rto(const struct pingmode *net, long tmax)
+{
+	long rto;
+
+	if (net->srtt == 0)
+		return tmax;
+
+	rto = net->srtt + 4L * net->rttvar;
+	if (rto < 1000L * ping_min_rto)
+		rto = 1000L * ping_min_rto;
+
+	return (rto < tmax) ? rto : tmax;
+}
+
+/*
+ * Mark every target waiting on an echo reply from 'from' with sequence 'seq' as
+ * having answered (normally one, but the same address may be listed twice) and
+ * add the round trip time to its statistics, using 'rx' as the time the reply
+ * arrived. Times outside 0 to 'max_rtt' usec mean the wall clock was stepped and
+ * are not used. Returns the number of targets newly marked, with the name and
+ * RTT of the last in *name and *rtt.
+ */
+
+static int reply_match(const struct sockaddr_storage *from, unsigned short seq, const struct timespec *rx,
+		       long max_rtt, const char **name, long *rtt)
+{
+	unsigned int ii = reply_hash(from, seq) & reply_mask;
+	int found = 0;
+
+	if (reply_tab == NULL)
+		return 0;
+
+	for (; reply_tab[ii].round == reply_round; ii = (ii + 1) & reply_mask) {
+		struct pingmode *net = &reply_tab[ii].act->parameter.net;
+
+		if (reply_tab[ii].seq == seq && same_addr(from, &net->to) && net->result == EDONTKNOW) {
+			const struct timespec *tx = &reply_tab[ii].tx;
+
+			*rtt = (rx->tv_sec - tx->tv_sec) * USEC + (rx->tv_nsec - tx->tv_nsec) / 1000;
+			if (*rtt < 0 || *rtt > max_rtt)
+				*rtt = -1;
+
+			net->result = ENOERR;
+			ping_answered(net, seq, *rtt);
+			*name = reply_tab[ii].act->name;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Read the send time stamps queued on a socket's error queue and, while we are
+ * sure which request they belong to, use them in place of the times we took.
+ */
+
+static void read_tx_stamps(struct icmp_sock *is)
+{
+	while (1) {
+		struct msghdr msg;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		struct sock_extended_err *serr = NULL;
+		struct timespec *ts = NULL;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = icmp_packet;
+		iov.iov_len = PKBUF_SIZE;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = icmp_control;
+		msg.msg_controllen = sizeof(icmp_control);
+
+		if (recvmsg(is->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				ts = &((struct scm_timestamping *)CMSG_DATA(cmsg))->ts[0];
+			} else if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+				   (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+				serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			}
+		}
+
+		if (ts != NULL && serr != NULL && serr->ee_errno == ENOMSG &&
+		    serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && is->tx_sync && serr->ee_data < is->tx_next) {
+			struct reply_slot *slot = &reply_tab[is->tx_slot[serr->ee_data]];
+
+			if (slot->round == reply_round && (ts->tv_sec != 0 || ts->tv_nsec != 0))
+				slot->tx = *ts;
+		}
+	}
+}
+
+/*
+ * Get a socket ready for a new round: clear out any old send time stamps and
+ * restart the kernel's count of packets sent, which it does when the OPT_ID flag
+ * is turned on again.
+ */
+
+static void tx_stamp_reset(struct icmp_sock *is)
+{
+	int flags = 0;
+
+	is->tx_sync = 0;
+	if (!is->tx_stamp)
+		return;
+
+	read_tx_stamps(is);
+
+	if (setsockopt(is->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+		return;
+
+	flags = TX_STAMP_FLAGS;
+	if (setsockopt(is->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot restart %s send time stamps (errno = %d = '%s')", is->pname, err, strerror(err));
+		is->tx_stamp = 0;
+		return;
+	}
+
+	is->tx_next = 0;
+	is->tx_sync = 1;
+}
+
+/*
+ * Send one echo request to a target, which has reply table entry 'slot'. Return
+ * ENOERR or the errno value.
+ */
+
+static int send_ping(struct list *act, unsigned short seq, unsigned int slot)
+{
+	struct pingmode *net = &act->parameter.net;
+	struct icmp_sock *is = family_sock(net->to.ss_family);
+	unsigned char outpack[DATALEN + 8];
+
+	if (is->fd < 0)
+		return (EBADF);
+
+	memset(outpack, 0, sizeof(outpack));
+
+	/* setup a ping message */
+	if (is->family == AF_INET6) {
+		struct icmp6_hdr *icp6 = (struct icmp6_hdr *)outpack;
+
+		/* The kernel always computes the ICMPv6 checksum, it covers the IPv6 pseudo-header. */
+		icp6->icmp6_type = ICMP6_ECHO_REQUEST;
+		icp6->icmp6_code = 0;
+		icp6->icmp6_seq = htons(seq);
+		icp6->icmp6_id = htons(daemon_pid);
+	} else {
+		struct icmphdr *icp = (struct icmphdr *)outpack;
+
+		icp->type = ICMP_ECHO;
+		icp->code = icp->checksum = 0;
+		icp->un.echo.sequence = htons(seq);
+		icp->un.echo.id = htons(daemon_pid);	/* ID */
+
+		/* compute ICMP checksum here (a datagram socket does it for us) */
+		if (!is->dgram)
+			icp->checksum = in_cksum((unsigned short *)icp, DATALEN + 8);
+	}
+
+	/* and send it out */
+	clock_gettime(CLOCK_REALTIME, &reply_tab[slot].tx);
+	if (sendto(is->fd, (char *)outpack, DATALEN + 8, 0, (struct sockaddr *)&net->to, family_len(is->family)) < 0) {
+		int err = errno;
+
+		/* We can't tell if the kernel counted this one for the send time stamps. */
+		is->tx_sync = 0;
+
+		/* if our kernel tells us the network is unreachable we are done */
+		if (err == ENETUNREACH) {
+			log_message(LOG_ERR, "network is unreachable (target: %s)", act->name);
+		} else {
+			log_message(LOG_ERR, "sendto gave error for target %s = %d = '%s'", act->name, err, strerror(err));
+		}
+
+		return (err);
+	}
+
+	if (is->tx_sync && is->tx_next <= reply_mask)
+		is->tx_slot[is->tx_next++] = slot;
+
+	return (ENOERR);
+}
+
+/*
+ * Read one packet from an ICMP socket and, if it is the reply to one of the echo
+ * requests sent in this round (sequence numbers first_seq onwards), mark that
+ * target as done and reduce *pending. Replies more than 'max_rtt' usec after
+ * sending do not count towards the RTT. Returns ENOERR if a packet was read,
+ * EAGAIN if there was none waiting, or the errno value of a failed read.
+ */
+
+static int read_reply(struct icmp_sock *is, unsigned short first_seq, int nseq, long max_rtt, int *pending)
+{
+	struct sockaddr_storage from;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	struct timespec rx;
+	const char *name = NULL;
+	int len, rcv_id, rcv_seq, idx, found, have_rx = 0;
+	long rtt = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = icmp_packet;
+	iov.iov_len = PKBUF_SIZE;
+	msg.msg_name = &from;
+	msg.msg_namelen = sizeof(from);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = icmp_control;
+	msg.msg_controllen = sizeof(icmp_control);
+
+	if ((len = recvmsg(is->fd, &msg, MSG_DONTWAIT)) < 0) {
+		int err = errno;
+
+		if (err == EINTR || err == EWOULDBLOCK)
+			return (EAGAIN);
+
+		if (err != EAGAIN)
+			log_message(LOG_ERR, "recvfrom gave errno = %d = '%s'", err, strerror(err));
+		return (err);
+	}
+
+	/* Use the kernel's time of arrival if it gave us one. */
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&rx, CMSG_DATA(cmsg), sizeof(rx));
+			have_rx = 1;
+		}
+	}
+	if (!have_rx)
+		clock_gettime(CLOCK_REALTIME, &rx);
+
+	/* check if packet is our ECHO */
+	if (is->family == AF_INET6) {
+		/* No IPv6 header to skip, raw ICMPv6 sockets never see it. */
+		struct icmp6_hdr *icp6 = (struct icmp6_hdr *)icmp_packet;
+
+		if (len < (int)sizeof(struct icmp6_hdr) || icp6->icmp6_type != ICMP6_ECHO_REPLY)
+			return (ENOERR);
+
+		rcv_id  = ntohs(icp6->icmp6_id);
+		rcv_seq = ntohs(icp6->icmp6_seq);
+	} else {
+		struct icmphdr *icp;
+		int hlen = 0;
+
+		if (!is->dgram)
+			hlen = ((struct ip *)icmp_packet)->ip_hl << 2;
+
+		icp = (struct icmphdr *)(icmp_packet + hlen);
+		if (len < hlen + 8 || icp->type != ICMP_ECHOREPLY)
+			return (ENOERR);
+
+		rcv_id  = ntohs(icp->un.echo.id);
+		rcv_seq = ntohs(icp->un.echo.sequence);
+	}
+
+	/* Have ping reply, but is it one we sent in this round? (The kernel has already checked the ID on a datagram socket.) */
+	if ((!is->dgram && rcv_id != daemon_pid) || (unsigned short)(rcv_seq - first_seq) >= nseq)
+		return (ENOERR);
+
+	idx = (unsigned short)(rcv_seq - first_seq);
+	found = reply_match(&from, rcv_seq, &rx, max_rtt, &name, &rtt);
+	*pending -= found;
+
+	if (found && verbose && logtick && ticker == 1) {
+		/* Report in milliseconds (like 'ping' program). */
+		log_message(LOG_DEBUG, "got answer on ping=%d from target %-15s time=%.3fms",
+			idx + 1, name, rtt / 1.0e3);
+	}
+
+	return (ENOERR);
+}
+
 /*
- * Check network / machine is accessible via 'ping' packet.
+ * Check network / machines are accessible via 'ping' packets.
+ *
+ * All 'num' targets are pinged together: an echo request is sent to every target
+ * that has not yet answered, then we wait on the shared sockets with a deadline of
+ * time/count seconds, and repeat up to 'count' times. So a round costs about one
+ * reply time-out no matter how many targets there are.
+ *
+ * With 'ping-adaptive' set each attempt waits only for the longest retransmission
+ * time-out of the targets still pending, doubling on each retry, so one lost
+ * packet costs a few RTTs rather than time/count seconds.
+ *
+ * The result for each target is left in targets[]->parameter.net.result and the
+ * return value is the number of targets that failed.
  */
 
-int check_net(char *target, int sock_fp, struct sockaddr to, unsigned char *packet, int time, int count)
+int check_net(struct list *targets[], int num, int time, int count)
 {
-	int i;
-	unsigned char outpack[MAXPACKET];
+	struct timeval sent[MAX_PINGCOUNT];	/* CLOCK_MONOTONIC */
 	struct timeval tmax;
+	unsigned short first_seq;
+	int ii, jj, pending, failed = 0;
+	long tmax_usec;
 	ldiv_t d;
 
-	if (target == NULL)
-		return (ENOERR);
+	if (num < 1)
+		return 0;
+
+	if (count < 1 || count > MAX_PINGCOUNT) {
+		for (ii = 0; ii < num; ii++)
+			targets[ii]->parameter.net.result = EINVAL;
+		return num;
+	}
 
-	if (count < 1)
-		return (EINVAL);
+	for (ii = 0; ii < num; ii++) {
+		targets[ii]->parameter.net.result = EDONTKNOW;
+	}
 
-	memset(outpack, 0, sizeof(outpack));
+	reply_reset(num * count);
+	for (ii = 0; ii < NUM_ICMP; ii++) {
+		struct icmp_sock *is = &icmp_socks[ii];
+
+		if (is->fd < 0)
+			continue;
+
+		if (!is->dgram && is->filter_id != (unsigned short)daemon_pid) {
+			attach_ping_filter(is->fd, is->family, daemon_pid, ping_list);
+			is->filter_id = (unsigned short)daemon_pid;
+		}
+
+		tx_stamp_reset(is);
+	}
 
 	/* set the timeout value */
 	d = ldiv(time, count);
 	tmax.tv_sec = d.quot;
 	/* Compute microseconds, including the above remainder. */
 	tmax.tv_usec = (d.rem * USEC) / count;
+	tmax_usec = tmax.tv_sec * USEC + tmax.tv_usec;
+
+	first_seq = ping_seq + 1;
+	pending = num;
 
 	/* try "ping-count" times */
-	for (i = 0; i < count; i++) {
+	for (jj = 0; jj < count && pending > 0; jj++) {
+		struct timeval timeout, dtimeout;
+		unsigned short seq = ++ping_seq;
 
-		struct sockaddr_in from;
-		fd_set fdmask;
-		socklen_t fromlen;
-		struct timeval tstart, timeout, dtimeout;
-		struct icmphdr *icp = (struct icmphdr *)outpack;
-		struct sockaddr_in *to_in = (struct sockaddr_in *)&to;
+		mono_now(&sent[jj]);
 
-		/* setup a ping message */
-		icp->type = ICMP_ECHO;
-		icp->code = icp->checksum = 0;
-		icp->un.echo.sequence = htons(i + 1);
-		icp->un.echo.id = htons(daemon_pid);	/* ID */
+		for (ii = 0; ii < num; ii++) {
+			struct pingmode *net = &targets[ii]->parameter.net;
 
-		/* compute ICMP checksum here */
-		icp->checksum = in_cksum((unsigned short *)icp, DATALEN + 8);
+			if (net->result == EDONTKNOW) {
+				int err;
 
-		/* and send it out */
-		if (sendto(sock_fp, (char *)outpack, DATALEN + 8, 0, &to, sizeof(struct sockaddr)) < 0) {
-			int err = errno;
+				/* Enter it first, a reply can arrive before sendto() returns. */
+				unsigned int slot = reply_add(targets[ii], seq);
+				ping_sent(net, seq);
+				err = send_ping(targets[ii], seq, slot);
+				if (err != ENOERR && net->result == EDONTKNOW) {
+					net->result = err;
+					pending--;
+				}
+			}
+		}
+
+		/* set the timeout value */
+		if (ping_adaptive) {
+			struct timeval trto;
+			long rto = 0;
 
-			/* if our kernel tells us the network is unreachable we are done */
-			if (err == ENETUNREACH) {
-				log_message(LOG_ERR, "network is unreachable (target: %s)", target);
-			} else {
-				log_message(LOG_ERR, "sendto gave error for target %s = %d = '%s'", target, err, strerror(err));
+			for (ii = 0; ii < num; ii++) {
+				struct pingmode *net = &targets[ii]->parameter.net;
+				if (net->result == EDONTKNOW && ping_rto(net, tmax_usec) > rto)
+					rto = ping_rto(net, tmax_usec);
 			}
 
-			return (err);
+			/* Back off on each retry, as TCP does. */
+			rto <<= (jj < 16) ? jj : 16;
+			if (rto > tmax_usec)
+				rto = tmax_usec;
+
+			trto.tv_sec = rto / USEC;
+			trto.tv_usec = rto % USEC;
+			timeradd(&sent[jj], &trto, &timeout);
+		} else {
+			timeradd(&sent[jj], &tmax, &timeout);
 		}
 
-		gettimeofday(&tstart, NULL);
-		/* set the timeout value */
-		timeradd(&tstart, &tmax, &timeout);
+		/* wait for replies */
+		while (pending > 0) {
+			struct pollfd pfd[NUM_ICMP];
+			struct icmp_sock *pis[NUM_ICMP];
+			int rv, npfd = 0, err = ENOERR;
 
-		/* wait for reply */
-		FD_ZERO(&fdmask);
-		FD_SET(sock_fp, &fdmask);
-		while (1) {
-			gettimeofday(&dtimeout, NULL);
+			mono_now(&dtimeout);
 			timersub(&timeout, &dtimeout, &dtimeout);
 			/* Check if we have timed out waiting for a reply. */
 			if ((long)dtimeout.tv_sec < 0)
 				break;
 
-#if 0
-			if (verbose && logtick && ticker == 1)
-				log_message(LOG_DEBUG, "ping select timeout = %2ld.%06ld seconds",
-				       dtimeout.tv_sec, dtimeout.tv_usec);
-#endif
+			for (ii = 0; ii < NUM_ICMP; ii++) {
+				if (icmp_socks[ii].fd >= 0) {
+					pfd[npfd].fd = icmp_socks[ii].fd;
+					pfd[npfd].events = POLLIN;	/* POLLERR for time stamps is implied */
+					pis[npfd++] = &icmp_socks[ii];
+				}
+			}
 
-			if (select(sock_fp + 1, &fdmask, NULL, NULL, &dtimeout) >= 1) {
-				/* read reply */
-				fromlen = sizeof(from);
-				if (recvfrom(sock_fp, packet, PKBUF_SIZE, 0, (struct sockaddr *)&from, &fromlen) < 0) {
-					int err = errno;
+			rv = poll(pfd, npfd, dtimeout.tv_sec * 1000 + (dtimeout.tv_usec + 999) / 1000);
+			if (rv < 0 && errno != EINTR) {
+				err = errno;
+				log_message(LOG_ERR, "poll gave errno = %d = '%s'", err, strerror(err));
+			}
 
-					if (err != EINTR) {
-						log_message(LOG_ERR, "recvfrom gave errno = %d = '%s'", err, strerror(err));
-						return (err);
-					}
-				} else {
-					/* check if packet is our ECHO */
-					icp = (struct icmphdr *)(packet + (((struct ip *)packet)->ip_hl << 2));
-
-					if (icp->type == ICMP_ECHOREPLY) {
-						int rcv_id  = ntohs(icp->un.echo.id);
-						int rcv_seq = ntohs(icp->un.echo.sequence);
-
-						/* Have ping reply, but is it the one we just sent? */
-						if (rcv_id  == daemon_pid &&
-							rcv_seq == (i + 1) &&
-							from.sin_addr.s_addr == to_in->sin_addr.s_addr) {
-
-							if (verbose && logtick && ticker == 1) {
-								/* Report time since tstart in milliseconds (like 'ping' program). */
-								double msec;
-								gettimeofday(&dtimeout, NULL);
-								timersub(&dtimeout, &tstart, &dtimeout);
-								msec = 1.0e3 * (dtimeout.tv_sec + 1.0e-6 * dtimeout.tv_usec);
-								log_message(LOG_DEBUG, "got answer on ping=%d from target %-15s time=%.3fms", i+1, target, msec);
-							}
-
-							return (ENOERR);
-						}
+			for (ii = 0; ii < npfd && rv > 0 && err == ENOERR; ii++) {
+				/* Send time stamps first so they are in place for the replies. */
+				if (pfd[ii].revents & POLLERR)
+					read_tx_stamps(pis[ii]);
+
+				if (pfd[ii].revents & POLLIN) {
+					/* Take everything queued, replies come in bursts. */
+					while (pending > 0 && (err = read_reply(pis[ii], first_seq, jj + 1, time * USEC, &pending)) == ENOERR) {
 					}
+					if (err == EAGAIN)
+						err = ENOERR;
+				}
+			}
+
+			if (err != ENOERR) {
+				/* Socket failure, report that for anyone still waiting. */
+				for (ii = 0; ii < num; ii++) {
+					if (targets[ii]->parameter.net.result == EDONTKNOW)
+						targets[ii]->parameter.net.result = err;
 				}
+				pending = 0;
+				break;
 			}
 		}
 	}
 
-	log_message(LOG_ERR, "no response from ping (target: %s)", target);
+	for (ii = 0; ii < num; ii++) {
+		struct pingmode *net = &targets[ii]->parameter.net;
+
+		int loss = ping_loss(net);
+
+		if (net->result == EDONTKNOW) {
+			log_message(LOG_ERR, "no response from ping (target: %s)", targets[ii]->name);
+			net->result = ENETUNREACH;
+		}
+
+		if (verbose && logtick && ticker == 1) {
+			char lbuf[16] = "n/a";
+			if (loss >= 0)
+				snprintf(lbuf, sizeof(lbuf), "%d%%", loss);
+			log_message(LOG_DEBUG, "ping statistics for %s: srtt=%.3fms rttvar=%.3fms loss=%s",
+				targets[ii]->name, net->srtt / 1.0e3, net->rttvar / 1.0e3, lbuf);
+		}
 
-	return (ENETUNREACH);
+		/* Still answering, but is it getting worse? */
+		if (net->result == ENOERR && ping_max_loss > 0 && loss > ping_max_loss) {
+			log_message(LOG_ERR, "lost %d%% of last %d pings (target: %s)", loss, ping_window, targets[ii]->name);
+			net->result = EPINGLOSS;
+		}
+
+		if (net->result == ENOERR && ping_max_rtt > 0 && net->srtt > 1000 * ping_max_rtt) {
+			log_message(LOG_ERR, "round trip time %.3fms too long (target: %s)", net->srtt / 1.0e3, targets[ii]->name);
+			net->result = ESLOWPING;
+		}
+
+		if (net->result != ENOERR)
+			failed++;
+	}
+
+	return failed;
 }
 
 /*
- * Close socket and free the packet buffer. As we zero this memory when originally
- * allocating it, a non-NULL packet buffer is an indicator it was opened.
+ * Open the shared socket for one address family.
  */
 
-static int close_net(struct pingmode *net)
+static void open_icmp(struct icmp_sock *is)
 {
-	int err = ENOERR;
+	struct protoent *proto;
+	int hold, rv;
 
-	if (net->packet != NULL) {
-		free(net->packet);
-		net->packet = NULL;
+	if (!(proto = getprotobyname(is->pname))) {
+		fatal_error(EX_SYSERR, "unknown protocol %s", is->pname);
+	}
 
-		if (close(net->sock_fp) < 0) {
-			err = errno;
-			log_message(LOG_ERR, "error closing socket (err = %d = '%s')", err, strerror(err));
+	/*
+	 * Try for a datagram ICMP socket first, this is only allowed if our group
+	 * is in the net.ipv4.ping_group_range sysctl (used for IPv6 as well). If
+	 * not, use a raw socket.
+	 */
+	is->dgram = 0;
+	if ((is->fd = socket(is->family, SOCK_DGRAM, proto->p_proto)) >= 0) {
+		is->dgram = 1;
+	} else {
+		int err = errno;
+		if (verbose) {
+			log_message(LOG_DEBUG, "%s datagram socket not available (errno = %d = '%s'), using raw socket",
+				is->pname, err, strerror(err));
 		}
-		net->sock_fp = -1;
+		is->fd = socket(is->family, SOCK_RAW, proto->p_proto);
 	}
 
-	return err;
+	if (is->fd < 0 || fcntl(is->fd, F_SETFD, FD_CLOEXEC)) {
+		fatal_error(EX_SYSERR, "error opening %s socket (%s)", is->pname, strerror(errno));
+	}
+
+	/* Kernel time stamps so the RTT is not skewed by how long we take to get to the replies. */
+	hold = 1;
+	if (setsockopt(is->fd, SOL_SOCKET, SO_TIMESTAMPNS, (char *)&hold, sizeof(hold)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "set receive time stamp error err = %d = '%s'", err, strerror(err));
+	}
+
+	hold = TX_STAMP_FLAGS;
+	is->tx_stamp = (setsockopt(is->fd, SOL_SOCKET, SO_TIMESTAMPING, (char *)&hold, sizeof(hold)) == 0);
+
+	if (verbose) {
+		log_message(LOG_INFO, "pinging %d %s target(s) with %s socket%s", is->num,
+			(is->family == AF_INET6) ? "IPv6" : "IPv4", is->dgram ? "datagram" : "raw",
+			is->tx_stamp ? " and send time stamps" : "");
+	}
+
+	/* set filter for only ECHOREPLY packets, a datagram socket only gets our replies anyway */
+	if (!is->dgram) {
+		if (is->family == AF_INET6) {
+			struct icmp6_filter filt6;
+			ICMP6_FILTER_SETBLOCKALL(&filt6);
+			ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filt6);
+			rv = setsockopt(is->fd, IPPROTO_ICMPV6, ICMP6_FILTER, (char *)&filt6, sizeof(filt6));
+		} else {
+			struct icmp_filter filt;
+			memset(&filt, 0, sizeof(filt));
+			filt.data = ~(1<<ICMP_ECHOREPLY);
+			rv = setsockopt(is->fd, SOL_RAW, ICMP_FILTER, (char *)&filt, sizeof(filt));
+		}
+
+		if (rv < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "set %s filter error err = %d = '%s'", is->pname, err, strerror(err));
+		}
+	}
+
+	/* this is necessary for broadcast pings to work (IPv6 has no broadcast) */
+	if (is->family == AF_INET) {
+		hold = 0; /* value should not matter, but zero to be safe. */
+		if (setsockopt(is->fd, SOL_SOCKET, SO_BROADCAST, (char *)&hold, sizeof(hold)) < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "set broadcast error err = %d = '%s'", err, strerror(err));
+		}
+	}
+
+	/* One socket takes the replies for every target, so size it to suit. */
+	hold = 48 * 1024;
+	if (is->num > 48)
+		hold = is->num * 1024;
+	if (setsockopt(is->fd, SOL_SOCKET, SO_RCVBUF, (char *)&hold, sizeof(hold)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "set revbuf error err = %d = '%s'", err, strerror(err));
+	}
+}
+
+/*
+ * Fill in the address of a target from its name. Returns -1 if it is not a
+ * numeric address.
+ */
+
+static int target_addr(struct list *act)
+{
+	struct pingmode *net = &act->parameter.net; /* 'net' is alias of act->parameter.net */
+	struct addrinfo hints, *res = NULL;
+
+	/* Only numeric IPv4 or IPv6 addresses, we don't want to depend on DNS. */
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_RAW;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	memset(&net->to, 0, sizeof(net->to));
+	if (getaddrinfo(act->name, NULL, &hints, &res) != 0 || res == NULL ||
+		res->ai_addrlen > sizeof(net->to)) {
+		if (res != NULL)
+			freeaddrinfo(res);
+		return -1;
+	}
+
+	memcpy(&(net->to), res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+
+	return 0;
 }
 
 /*
@@ -214,90 +920,186 @@ static int close_net(struct pingmode *net)
 int open_netcheck(struct list *tlist)
 {
 	struct list *act;
-	int hold;
-	struct icmp_filter filt;
-	memset(&filt, 0, sizeof(filt));
-	filt.data = ~(1<<ICMP_ECHOREPLY);
+	int ii;
 
 	if (tlist != NULL) {
-		/* Have at least on ping target to configure, get ICMP settings. */
-		struct protoent *proto;
-		const char pname[] = "icmp";
-
-		if (!(proto = getprotobyname(pname))) {
-			fatal_error(EX_SYSERR, "unknown protocol %s", pname);
-			return -1;
-		}
+		close_netcheck(NULL);
+		ping_list = tlist;
 
 		for (act = tlist; act != NULL; act = act->next) {
-			struct pingmode *net = &act->parameter.net; /* 'net' is alias of act->parameter.net */
-			struct sockaddr_in *to_in;
-
-			close_net(net);
-
-			/* setup the socket */
-			memset(&(net->to), 0, sizeof(struct sockaddr));
-			/*
-			 * This pointer is an alias to same memory, an ugly but common
-			 * method, for example http://www.retran.com/beej/sockaddr_inman.html
-			 * Also we don't (yet) support IPv6 which needs a bigger structure
-			 * anyway (e.g. the 'struct sockaddr_storage' type for all) and other
-			 * changes around here.
-			 */
-			to_in = (struct sockaddr_in *)&(net->to);
-
-			to_in->sin_family = AF_INET;
-			to_in->sin_addr.s_addr = inet_addr(act->name);
-
-			if (to_in->sin_addr.s_addr == INADDR_NONE) {
+			/* Clears the statistics as well. */
+			memset(&act->parameter.net, 0, sizeof(act->parameter.net));
+			if (target_addr(act) < 0) {
 				fatal_error(EX_USAGE, "unknown host %s", act->name);
 			}
 
-			net->packet = (unsigned char *)xcalloc(PKBUF_SIZE, sizeof(char));
+			family_sock(act->parameter.net.to.ss_family)->num++;
+		}
 
-			if ((net->sock_fp = socket(AF_INET, SOCK_RAW, proto->p_proto)) < 0 ||
-				fcntl(net->sock_fp, F_SETFD, FD_CLOEXEC)) {
-				fatal_error(EX_SYSERR, "error opening socket (%s)", strerror(errno));
-			}
+		for (ii = 0; ii < NUM_ICMP; ii++) {
+			if (icmp_socks[ii].num > 0)
+				open_icmp(&icmp_socks[ii]);
+		}
+	}
 
-			/* set filter for only ECOREPLY packet (configured in the filt.dat value above) */
-			if (setsockopt(net->sock_fp, SOL_RAW, ICMP_FILTER, (char*)&filt, sizeof(filt)) < 0) {
-				int err = errno;
-				log_message(LOG_ERR, "set ICMP filter error for target %s err = %d = '%s'", act->name, err, strerror(err));
-			}
+	return 0;
+}
 
-			/* this is necessary for broadcast pings to work */
-			hold = 0; /* value should not matter, but zero to be safe. */
-			if (setsockopt(net->sock_fp, SOL_SOCKET, SO_BROADCAST, (char *)&hold, sizeof(hold)) < 0) {
-				int err = errno;
-				log_message(LOG_ERR, "set broadcast error for target %s err = %d = '%s'", act->name, err, strerror(err));
-			}
+/*
+ * Check every target in 'tlist' can be pinged, before a reload takes them up.
+ * Returns -1 if any can't.
+ */
 
-			hold = 48 * 1024;
-			if (setsockopt(net->sock_fp, SOL_SOCKET, SO_RCVBUF, (char *)&hold, sizeof(hold)) < 0) {
-				int err = errno;
-				log_message(LOG_ERR, "set revbuf error for target %s err = %d = '%s'", act->name, err, strerror(err));
-			}
+int valid_targets(struct list *tlist)
+{
+	struct list *act;
+	int rv = 0;
+
+	for (act = tlist; act != NULL; act = act->next) {
+		if (target_addr(act) < 0) {
+			log_message(LOG_ERR, "unknown host %s", act->name);
+			rv = -1;
 		}
 	}
 
-	return 0;
+	return rv;
 }
 
+static void net_event(int fd, unsigned int events, void *ptr);
+
 /*
- * Shut sockets and free memory as allocated by open_netcheck().
+ * Move pinging over to the targets in 'tlist' after a reload, keeping the state
+ * already in their entries. A socket is only opened or closed as the first target
+ * of its address family comes or the last one goes, but the raw socket filters
+ * are rebuilt for the new addresses.
  */
 
-int close_netcheck(struct list *tlist)
+int reopen_netcheck(struct list *tlist)
 {
-	int err = 0;
 	struct list *act;
+	int ii, err = 0;
 
-	if (tlist != NULL) {
-		for (act = tlist; act != NULL; act = act->next) {
-			err |= close_net(&act->parameter.net);
+	for (ii = 0; ii < NUM_ICMP; ii++)
+		icmp_socks[ii].num = 0;
+
+	for (act = tlist; act != NULL; act = act->next) {
+		if (target_addr(act) < 0) {
+			fatal_error(EX_USAGE, "unknown host %s", act->name);
+		}
+
+		family_sock(act->parameter.net.to.ss_family)->num++;
+	}
+
+	ping_list = tlist;
+
+	for (ii = 0; ii < NUM_ICMP; ii++) {
+		struct icmp_sock *is = &icmp_socks[ii];
+
+		if (is->num > 0 && is->fd < 0) {
+			open_icmp(is);
+			err |= event_add_fd(is->fd, EPOLLIN, net_event, is);
+		} else if (is->num == 0 && is->fd >= 0) {
+			event_del_fd(is->fd);
+			close(is->fd);
+			is->fd = -1;
+			is->tx_stamp = 0;
+		}
+
+		free(is->tx_slot);
+		is->tx_slot = NULL;
+		is->tx_sync = 0;
+		is->filter_id = -1;
+	}
+
+	/* It still points at the old entries, and is remade with the right size next round. */
+	free(reply_tab);
+	reply_tab = NULL;
+	reply_mask = 0;
+	reply_round = 0;
+
+	return err;
+}
+
+/*
+ * Called from the event loop when a ping socket has data between checks. These
+ * can only be late replies (or someone else's replies) so read and discard them
+ * now, rather than having check_net() wade through them on the next interval.
+ */
+
+static void net_event(int fd, unsigned int events, void *ptr)
+{
+	int count = 0;
+
+	while (recv(fd, icmp_packet, PKBUF_SIZE, MSG_DONTWAIT) >= 0) {
+		count++;
+	}
+
+	/* And any send time stamps that came in after the round ended. */
+	if (events & EPOLLERR)
+		read_tx_stamps((struct icmp_sock *)ptr);
+
+	if (verbose > 1 && count > 0) {
+		log_message(LOG_DEBUG, "discarded %d late ping packet(s)", count);
+	}
+}
+
+/*
+ * Register the sockets set up by open_netcheck() with the event loop.
+ */
+
+int watch_netcheck(struct list *tlist)
+{
+	int ii, err = 0;
+
+	if (tlist == NULL)
+		return 0;
+
+	for (ii = 0; ii < NUM_ICMP; ii++) {
+		if (icmp_socks[ii].fd >= 0)
+			err |= event_add_fd(icmp_socks[ii].fd, EPOLLIN, net_event, &icmp_socks[ii]);
+	}
+
+	return err;
+}
+
+/*
+ * Shut the sockets and free memory as allocated by open_netcheck().
+ */
+
+int close_netcheck(struct list *tlist)
+{
+	int ii, err = 0;
+
+	for (ii = 0; ii < NUM_ICMP; ii++) {
+		struct icmp_sock *is = &icmp_socks[ii];
+
+		if (is->fd >= 0) {
+			event_del_fd(is->fd);
+
+			if (close(is->fd) < 0) {
+				err = errno;
+				log_message(LOG_ERR, "error closing socket (err = %d = '%s')", err, strerror(err));
+			}
+			is->fd = -1;
+		}
+		is->num = 0;
+		is->tx_stamp = is->tx_sync = 0;
+		is->filter_id = -1;
+
+		if (is->tx_slot != NULL) {
+			free(is->tx_slot);
+			is->tx_slot = NULL;
 		}
 	}
 
+	if (reply_tab != NULL) {
+		free(reply_tab);
+		reply_tab = NULL;
+		reply_mask = 0;
+		reply_round = 0;
+	}
+
+	ping_list = NULL;
+
 	return err;
 }
@@ -14,52 +14,29 @@
 
 int check_pidfile(struct list *file)
 {
-	int fd = open(file->name, O_RDONLY), pid;
 	char buf[20];
-	int n;
+	long pid = 0;
+	int err;
 
-	if (fd == -1) {
-		int err = errno;
-		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", file->name, err, strerror(err));
+	/* The file is read afresh each time, as the server may have replaced it. */
+	if ((err = proc_read_once(file->name, buf, sizeof(buf))) != ENOERR)
 		return (err);
-	}
 
-	/* position pointer at start of file */
-	if (lseek(fd, 0, SEEK_SET) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "lseek %s gave errno = %d = '%s'", file->name, err, strerror(err));
-		close(fd);
-		return (err);
-	}
-
-	/* read the line (there is only one) */
-	if ((n = read(fd, buf, sizeof(buf)-1)) < 0) {
-		int err = errno;
-		log_message(LOG_ERR, "read %s gave errno = %d = '%s'", file->name, err, strerror(err));
-		close(fd);
-		return (err);
-	}
-	/* Force string to be nul-terminated. */
-	buf[n] = 0;
-
-	/* we only care about integer values */
-	pid = atoi(buf);
-
-	if (close(fd) == -1) {
-		int err = errno;
-		log_message(LOG_ERR, "could not close %s, errno = %d = '%s'", file->name, err, strerror(err));
-		return (err);
+	/* we only care about integer values, and kill() takes 0 as our own process group */
+	if (proc_columns(buf, 0, &pid, 1) != 1 || pid <= 0) {
+		log_message(LOG_ERR, "no process id in %s", file->name);
+		return (EINVAL);
 	}
 
-	if (kill(pid, 0) == -1) {
-		int err = errno;
-		log_message(LOG_ERR, "pinging process %d (%s) gave errno = %d = '%s'", pid, file->name, err, strerror(err));
+	if (kill((pid_t)pid, 0) == -1) {
+		err = errno;
+		log_message(LOG_ERR, "pinging process %ld (%s) gave errno = %d = '%s'", pid, file->name, err, strerror(err));
 		return (err);
 	}
 
 	/* do verbose logging */
 	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "was able to ping process %d (%s)", pid, file->name);
+		log_message(LOG_DEBUG, "was able to ping process %ld (%s)", pid, file->name);
 
 	return (ENOERR);
 }
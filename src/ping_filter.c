@@ -0,0 +1,218 @@
+/* > ping_filter.c
+ *
+ * Classic BPF socket filter for the raw ICMP sockets used by net.c. A raw socket
+ * is given a copy of every echo reply the host receives (for example those of a
+ * monitoring agent pinging thousands of machines), so without this we are woken
+ * and have to copy and discard each one. The filter has the kernel drop anything
+ * that is not an echo reply carrying our identifier from one of our targets.
+ *
+ * IPv4 source addresses are found by a binary search over the sorted targets,
+ * IPv6 ones by a simple list as there are normally only a few. If there are too
+ * many targets to fit in a filter program only the type and identifier are
+ * checked.
+ *
+ * Datagram ICMP sockets don't need this as the kernel already matches replies
+ * to the socket by identifier.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include <linux/icmp.h>
+#include <netinet/icmp6.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define LEAF_SIZE	4		/* Addresses compared in turn at the bottom of the search tree. */
+#define ACCEPT		0xffffffff	/* Return value to keep the whole packet. */
+#define DROP		0
+
+struct prog {
+	struct sock_filter *insn;
+	int len;
+};
+
+static void emit(struct prog *p, unsigned short code, unsigned char jt, unsigned char jf, unsigned int k)
+{
+	if (p->len < BPF_MAXINSNS) {
+		p->insn[p->len].code = code;
+		p->insn[p->len].jt = jt;
+		p->insn[p->len].jf = jf;
+		p->insn[p->len].k = k;
+	}
+	p->len++;
+}
+
+/* Drop the packet unless the accumulator equals 'k'. */
+static void emit_require(struct prog *p, unsigned int k)
+{
+	emit(p, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, k);
+	emit(p, BPF_RET | BPF_K, 0, 0, DROP);
+}
+
+static int cmp_addr4(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Search for the accumulator in the sorted list addr[0..n-1]. Conditional jumps
+ * can only skip 255 instructions, so each branch point jumps over an unlimited
+ * BPF_JA to reach the upper half.
+ */
+
+static void emit_tree4(struct prog *p, const unsigned int *addr, int n)
+{
+	int ii, mid, ja;
+
+	if (n <= LEAF_SIZE) {
+		for (ii = 0; ii < n; ii++)
+			emit(p, BPF_JMP | BPF_JEQ | BPF_K, n - ii, 0, addr[ii]);
+		emit(p, BPF_RET | BPF_K, 0, 0, DROP);
+		emit(p, BPF_RET | BPF_K, 0, 0, ACCEPT);
+		return;
+	}
+
+	mid = n / 2;
+	emit(p, BPF_JMP | BPF_JGE | BPF_K, 0, 1, addr[mid]);
+	ja = p->len;
+	emit(p, BPF_JMP | BPF_JA, 0, 0, 0);
+
+	emit_tree4(p, addr, mid);
+	if (ja < BPF_MAXINSNS)
+		p->insn[ja].k = p->len - ja - 1;
+	emit_tree4(p, addr + mid, n - mid);
+}
+
+static void build_filter4(struct prog *p, unsigned short id, struct list *tlist)
+{
+	unsigned int *addr;
+	struct list *act;
+	int ii, num = 0, used = 0;
+
+	/* X = IP header length, then check the ICMP type and identifier. */
+	emit(p, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0);
+	emit(p, BPF_LD | BPF_B | BPF_IND, 0, 0, 0);
+	emit_require(p, ICMP_ECHOREPLY);
+	emit(p, BPF_LD | BPF_H | BPF_IND, 0, 0, 4);
+	emit_require(p, id);
+
+	if (tlist == NULL) {
+		emit(p, BPF_RET | BPF_K, 0, 0, ACCEPT);
+		return;
+	}
+
+	for (act = tlist; act != NULL; act = act->next)
+		num++;
+
+	addr = (unsigned int *)xcalloc(num + 1, sizeof(unsigned int));
+	for (act = tlist; act != NULL; act = act->next) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)&act->parameter.net.to;
+		if (in->sin_family == AF_INET)
+			addr[used++] = ntohl(in->sin_addr.s_addr);
+	}
+
+	qsort(addr, used, sizeof(unsigned int), cmp_addr4);
+	for (ii = 1, num = (used > 0); ii < used; ii++) {
+		if (addr[ii] != addr[num - 1])
+			addr[num++] = addr[ii];
+	}
+
+	/* Source address from the IP header. */
+	emit(p, BPF_LD | BPF_W | BPF_ABS, 0, 0, 12);
+	emit_tree4(p, addr, num);
+
+	free(addr);
+}
+
+static void build_filter6(struct prog *p, unsigned short id, struct list *tlist)
+{
+	struct list *act;
+
+	/* Raw ICMPv6 sockets see the packet from the ICMPv6 header on. */
+	emit(p, BPF_LD | BPF_B | BPF_ABS, 0, 0, 0);
+	emit_require(p, ICMP6_ECHO_REPLY);
+	emit(p, BPF_LD | BPF_H | BPF_ABS, 0, 0, 4);
+	emit_require(p, id);
+
+	if (tlist == NULL) {
+		emit(p, BPF_RET | BPF_K, 0, 0, ACCEPT);
+		return;
+	}
+
+	/* The source address is at offset 8 of the IPv6 header, compare it a word at a time. */
+	for (act = tlist; act != NULL; act = act->next) {
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&act->parameter.net.to;
+		unsigned int w[4];
+		int ii;
+
+		if (in6->sin6_family != AF_INET6)
+			continue;
+
+		memcpy(w, &in6->sin6_addr, sizeof(w));
+		for (ii = 0; ii < 4; ii++) {
+			emit(p, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 8 + 4 * ii);
+			emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 2 * (3 - ii) + 1, ntohl(w[ii]));
+		}
+		emit(p, BPF_RET | BPF_K, 0, 0, ACCEPT);
+	}
+
+	emit(p, BPF_RET | BPF_K, 0, 0, DROP);
+}
+
+/*
+ * Attach a filter to the raw socket 'fd' of address family 'family' passing only
+ * echo replies with identifier 'id' from the targets in 'tlist' (entries of the
+ * other family are skipped, and NULL accepts any source). Returns 0 on success,
+ * else the errno value.
+ */
+
+int attach_ping_filter(int fd, int family, unsigned short id, struct list *tlist)
+{
+	struct sock_fprog fprog;
+	struct prog p;
+	int err = 0;
+
+	p.insn = (struct sock_filter *)xcalloc(BPF_MAXINSNS, sizeof(struct sock_filter));
+	p.len = 0;
+
+	if (family == AF_INET6)
+		build_filter6(&p, id, tlist);
+	else
+		build_filter4(&p, id, tlist);
+
+	if (p.len > BPF_MAXINSNS) {
+		/* Too many targets to list, settle for checking the identifier. */
+		log_message(LOG_INFO, "too many ping targets for socket filter, only checking ICMP identifier");
+		p.len = 0;
+		if (family == AF_INET6)
+			build_filter6(&p, id, NULL);
+		else
+			build_filter4(&p, id, NULL);
+	}
+
+	fprog.len = p.len;
+	fprog.filter = p.insn;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+		err = errno;
+		log_message(LOG_ERR, "cannot attach ping socket filter (errno = %d = '%s')", err, strerror(err));
+	} else if (verbose) {
+		log_message(LOG_DEBUG, "attached %d instruction socket filter for IPv%d ping replies",
+			p.len, (family == AF_INET6) ? 6 : 4);
+	}
+
+	free(p.insn);
+	return err;
+}
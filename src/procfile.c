@@ -0,0 +1,289 @@
+/* > procfile.c
+ *
+ * Reading and parsing the small text files under /proc and /sys that the checks
+ * look at, such as /proc/meminfo, /proc/loadavg and /proc/net/dev.
+ *
+ * A 'struct proc_file' keeps its file open and is re-read with pread() from the
+ * start each time, in to a buffer given by its user, so nothing is allocated on
+ * the way. Should the file outgrow that buffer (say /proc/net/dev on a host with
+ * many interfaces) a larger one is allocated once and kept. The contents are a snapshot for the current pass of the main loop,
+ * as started by proc_next_pass(), so checks that look at the same file in one
+ * pass (say several interfaces in /proc/net/dev) only read it once. Until the
+ * first proc_next_pass() call every proc_read() reads the file again.
+ *
+ * The parsers work on the nul-terminated text in a single pass, taking numbers
+ * as atoi() would (so "0.52" in /proc/loadavg gives 0).
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+/* The most a proc_file buffer is grown to. */
+#define PROC_MAX_SIZE	(1024 * 1024)
+
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long proc_pass = 0;
+
+/*
+ * Start a new pass of the main loop: each file is read again when next asked for.
+ * Only call this while no check is running in a worker.
+ */
+
+void proc_next_pass(void)
+{
+	if (++proc_pass == 0)
+		proc_pass = 1;
+}
+
+/*
+ * Read the whole of the file open on 'fd' from its start in to 'buf' and make it
+ * a string. Returns ENOERR, EOVERFLOW (not logged) if the file is larger than
+ * 'size' - 1 bytes, in which case 'buf' holds its start, or the error, which is
+ * logged against 'name'.
+ */
+
+int proc_pread(int fd, const char *name, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	for (;;) {
+		char extra;
+		ssize_t n;
+
+		/* Once full, see if there is any more to it than that. */
+		if (len < size - 1)
+			n = pread(fd, buf + len, size - 1 - len, (off_t)len);
+		else
+			n = pread(fd, &extra, 1, (off_t)len);
+
+		if (n < 0) {
+			int err = errno;
+			if (err == EINTR)
+				continue;
+			log_message(LOG_ERR, "read %s gave errno = %d = '%s'", name, err, strerror(err));
+			buf[0] = '\0';
+			return (err);
+		}
+
+		if (n == 0)
+			break;
+
+		if (len == size - 1) {
+			buf[len] = '\0';
+			return (EOVERFLOW);
+		}
+
+		len += n;
+	}
+
+	buf[len] = '\0';
+	return (ENOERR);
+}
+
+/*
+ * Read a file that can't be kept open (e.g. it may be replaced) in to 'buf'.
+ * Only its start is wanted, so a file larger than 'buf' is not an error.
+ * Returns ENOERR or the error, which is logged.
+ */
+
+int proc_read_once(const char *name, char *buf, size_t size)
+{
+	int fd, err;
+
+	buf[0] = '\0';
+
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+		err = errno;
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", name, err, strerror(err));
+		return (err);
+	}
+
+	err = proc_pread(fd, name, buf, size);
+	close(fd);
+	return (err == EOVERFLOW) ? ENOERR : err;
+}
+
+/*
+ * Read 'pf' in to its buffer, moving to a larger one for as long as the file does
+ * not fit. Called with 'proc_lock' held, and only when no check can be looking at
+ * the old contents. Returns ENOERR or the error, which is logged.
+ */
+
+static int read_proc_file(struct proc_file *pf)
+{
+	int err;
+
+	while ((err = proc_pread(pf->fd, pf->name, pf->buf, pf->size)) == EOVERFLOW) {
+		size_t size = 2 * pf->size;
+
+		if (size > PROC_MAX_SIZE) {
+			log_message(LOG_ERR, "%s is larger than %lu bytes, not reading it", pf->name,
+				    (unsigned long)pf->size - 1);
+			pf->buf[0] = '\0';
+			break;
+		}
+
+		log_message(LOG_INFO, "%s is larger than %lu bytes, reading it in to %lu", pf->name,
+			    (unsigned long)pf->size - 1, (unsigned long)size);
+		free(pf->alloc);
+		pf->alloc = pf->buf = (char *)xmalloc(size);
+		pf->size = size;
+	}
+
+	return (err);
+}
+
+/*
+ * Open the file now, rather than on its first proc_read(), to report any problem
+ * up front. Returns 0 or -1.
+ */
+
+int proc_open(struct proc_file *pf)
+{
+	proc_close(pf);
+
+	if ((pf->fd = open(pf->name, O_RDONLY | O_CLOEXEC)) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", pf->name, err, strerror(err));
+		return -1;
+	}
+
+	pf->pass = 0;
+	return 0;
+}
+
+/*
+ * Get the contents of the file for this pass in '*data', reading it if that has
+ * not been done yet. Returns ENOERR or the error.
+ */
+
+int proc_read(struct proc_file *pf, const char **data)
+{
+	int err = ENOERR;
+
+	pthread_mutex_lock(&proc_lock);
+
+	if (proc_pass == 0 || pf->pass != proc_pass) {
+		if (pf->fd < 0 && (pf->fd = open(pf->name, O_RDONLY | O_CLOEXEC)) < 0) {
+			err = errno;
+			log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", pf->name, err, strerror(err));
+		} else {
+			err = read_proc_file(pf);
+		}
+
+		/* A failure is not kept, the next check tries again. */
+		pf->pass = (err == ENOERR) ? proc_pass : 0;
+	}
+
+	pthread_mutex_unlock(&proc_lock);
+
+	*data = pf->buf;
+	return (err);
+}
+
+int proc_close(struct proc_file *pf)
+{
+	int rv = 0;
+
+	if (pf->fd >= 0 && close(pf->fd) == -1) {
+		log_message(LOG_ALERT, "cannot close %s (errno = %d)", pf->name, errno);
+		rv = -1;
+	}
+
+	pf->fd = -1;
+	pf->pass = 0;
+	pf->buf[0] = '\0';
+	return rv;
+}
+
+/* ============================================================================ */
+
+static const char *skip_white(const char *ptr)
+{
+	while (*ptr == ' ' || *ptr == '\t')
+		ptr++;
+	return ptr;
+}
+
+static const char *skip_field(const char *ptr)
+{
+	while (*ptr != '\0' && *ptr != ' ' && *ptr != '\t' && *ptr != '\n')
+		ptr++;
+	return ptr;
+}
+
+/*
+ * Take the numbers from the blank-separated fields of the first line of 'str',
+ * after skipping 'skip' fields, in to 'vals'. Returns how many were found.
+ */
+
+int proc_columns(const char *str, int skip, long vals[], int num)
+{
+	const char *ptr = skip_white(str);
+	int found = 0;
+
+	for (; skip > 0 && *ptr != '\0' && *ptr != '\n'; skip--)
+		ptr = skip_white(skip_field(ptr));
+
+	while (found < num && *ptr != '\0' && *ptr != '\n') {
+		char *end;
+		long val = strtol(ptr, &end, 10);
+
+		if (end == ptr)
+			break;
+
+		vals[found++] = val;
+		ptr = skip_white(skip_field(end));
+	}
+
+	return found;
+}
+
+/*
+ * Look through the lines of 'str' for those starting with one of the 'keys', as
+ * in "MemFree:  1234 kB" or "  eth0: 5678 ...", and take the first number after
+ * it in to the matching 'vals'. A key is the text up to a ':' or blank. Returns
+ * how many of the keys were found.
+ */
+
+int proc_keys(const char *str, const char *const keys[], long vals[], int num)
+{
+	const char *ptr = str;
+	int found = 0;
+
+	while (*ptr != '\0' && found < num) {
+		const char *key = skip_white(ptr);
+		size_t len = strcspn(key, ": \t\n");
+		int ii;
+
+		for (ii = 0; ii < num; ii++) {
+			if (strncmp(key, keys[ii], len) == 0 && keys[ii][len] == '\0') {
+				const char *val = key + len;
+
+				if (*val == ':')
+					val++;
+				vals[ii] = strtol(val, NULL, 10);
+				found++;
+				break;
+			}
+		}
+
+		if ((ptr = strchr(key + len, '\n')) == NULL)
+			break;
+		ptr++;
+	}
+
+	return found;
+}
@@ -19,10 +19,38 @@
 #include <errno.h>
 #include <string.h>
 #include <ctype.h> /* for isdigit() */
+#include <stddef.h> /* for offsetof() */
+#include <stdio.h> /* for snprintf() */
+#include <limits.h> /* for PATH_MAX */
 
 #include "extern.h"
 #include "read-conf.h"
 
+/* Where the line being parsed came from, for the warnings below. */
+static const char *where_file = NULL;
+static int where_line = 0;
+static char where_buf[64 + PATH_MAX];
+
+/*
+ * Give the file name and line number being parsed, or NULL when done, so the
+ * warnings say where the problem is.
+ */
+
+void read_location(const char *fname, int line)
+{
+	where_file = fname;
+	where_line = line;
+}
+
+static const char *where(void)
+{
+	if (where_file == NULL)
+		return "";
+
+	snprintf(where_buf, sizeof(where_buf), " at line %d of %s", where_line, where_file);
+	return where_buf;
+}
+
 /*
  * Return 1 if a character is "white space", so space, tab, CR, LF, etc.
  * Return 0 for anything else.
@@ -120,10 +148,10 @@ int read_int_func(char *arg, char *val, const char *name, int imin, int imax, in
 			if (imax > imin) {
 				/* have limits, check and enforce them. */
 				if (ii > imax) {
-					log_message(LOG_WARNING, "Warning: number for '%s' too big (%d > imax=%d)", arg, ii, imax);
+					log_message(LOG_WARNING, "Warning: number for '%s' too big (%d > imax=%d)%s", arg, ii, imax, where());
 					ii = imax;
 				} else if (ii < imin) {
-					log_message(LOG_WARNING, "Warning: number for '%s' too small (%d < imin=%d)", arg, ii, imin);
+					log_message(LOG_WARNING, "Warning: number for '%s' too small (%d < imin=%d)%s", arg, ii, imin, where());
 					ii = imin;
 				}
 			}
@@ -131,7 +159,7 @@ int read_int_func(char *arg, char *val, const char *name, int imin, int imax, in
 			*iv = ii;
 			if (verbose) log_message(LOG_DEBUG, "Integer '%s' found = %d", arg, *iv);
 		} else {
-			log_message(LOG_WARNING, "Warning: number expected for '%s'", arg);
+			log_message(LOG_WARNING, "Warning: number expected for '%s'%s", arg, where());
 		}
 	}
 
@@ -174,7 +202,7 @@ int read_string_func(char *arg, char *val, const char *name, string_read_e mode,
 					break;
 
 				case Read_string_only:
-					log_message(LOG_WARNING, "Warning: blank string not allowed for '%s = %s'", arg, *str);
+					log_message(LOG_WARNING, "Warning: blank string not allowed for '%s = %s'%s", arg, *str, where());
 					break;
 
 				default:
@@ -240,13 +268,54 @@ int read_list_func(char *arg, char *val, const char *name, int version, struct l
 			add_list(list, val, version);
 			if (verbose) log_message(LOG_DEBUG, "List '%s' added as '%s'", arg, val);
 		} else {
-			log_message(LOG_WARNING, "Warning: string expected for '%s'", arg);
+			log_message(LOG_WARNING, "Warning: string expected for '%s'%s", arg, where());
 		}
 	}
 
 	return rv;
 }
 
+/*
+ * The entries of a list are kept together in one array, in the order they were
+ * added, so adding to a long list is cheap and walking it touches consecutive
+ * memory. Each entry's 'next' points at the one after it, so a list can still be
+ * walked as before. The latency histograms are only written once per check and
+ * are much bigger than the rest of an entry, so they live in an array of their
+ * own rather than spread the entries apart.
+ *
+ * The list pointer is the start of 'entries', the rest of the block is just
+ * ahead of it.
+ */
+
+#define LIST_CHUNK	4	/* Initial entries, doubled as needed. */
+
+struct list_block {
+	int num;
+	int size;
+	struct histogram *latency;
+	struct list entries[];
+};
+
+static struct list_block *list_block(const struct list *list)
+{
+	return (struct list_block *)((char *)list - offsetof(struct list_block, entries));
+}
+
+/*
+ * Point every entry's 'next' and 'latency' at the right place, after the block
+ * has moved.
+ */
+
+static void link_block(struct list_block *blk)
+{
+	int ii;
+
+	for (ii = 0; ii < blk->num; ii++) {
+		blk->entries[ii].next = (ii + 1 < blk->num) ? &blk->entries[ii + 1] : NULL;
+		blk->entries[ii].latency = &blk->latency[ii];
+	}
+}
+
 /*
  * Add a new configuration list entry. Calling arguments are:
  *
@@ -259,29 +328,68 @@ int read_list_func(char *arg, char *val, const char *name, int version, struct l
  * name		: Name of the object, this is duplicated so 'name' can change afterwards.
  * version	: Version number for test & repair binary.
  *
+ * NOTE: Adding may move the whole list, so any pointer to one of its entries
+ * (other than '*list') is no longer valid afterwards.
  */
 
 void add_list(struct list **list, const char *name, int version)
 {
-	struct list *new, *act;
+	struct list_block *blk;
+	struct list *new;
 
 	if (list == NULL || name == NULL)
 		return;
 
-	/* Use xcalloc() to allocate and *zero* a block of memory. */
-	new = (struct list *)xcalloc(1, sizeof(struct list));
+	blk = (*list != NULL) ? list_block(*list) : NULL;
+
+	if (blk == NULL || blk->num >= blk->size) {
+		int num = (blk != NULL) ? blk->num : 0;
+		int size = (blk != NULL) ? 2 * blk->size : LIST_CHUNK;
+		struct histogram *latency = (blk != NULL) ? blk->latency : NULL;
+
+		blk = (struct list_block *)realloc(blk, sizeof(struct list_block) + size * sizeof(struct list));
+		if (blk == NULL || (latency = (struct histogram *)realloc(latency, size * sizeof(struct histogram))) == NULL) {
+			fatal_error(EX_SYSERR, "out of memory for %d list entries", size);
+		}
+
+		blk->num = num;
+		blk->size = size;
+		blk->latency = latency;
+		link_block(blk);
+	}
+
+	new = &blk->entries[blk->num];
+	memset(new, 0, sizeof(*new));
+	memset(&blk->latency[blk->num], 0, sizeof(struct histogram));
+
 	/* Make a copy of 'name' in case it changes elsewhere. */
 	new->name = xstrdup(name);
 	new->version = version;
+	new->latency = &blk->latency[blk->num];
 
-	if (*list == NULL) {
-		*list = new;
-	} else {
-		for (act = *list; act->next != NULL; act = act->next) {
-		}
-		/* The for() loop will seek to end of list, add new link to there. */
-		act->next = new;
-	}
+	if (blk->num > 0)
+		blk->entries[blk->num - 1].next = new;
+	blk->num++;
+
+	*list = blk->entries;
+}
+
+/*
+ * Return the number of entries in a list.
+ */
+
+int list_count(const struct list *list)
+{
+	return (list != NULL) ? list_block(list)->num : 0;
+}
+
+/*
+ * Return the last entry of a list, or NULL if it is empty.
+ */
+
+struct list *list_tail(struct list *list)
+{
+	return (list != NULL) ? &list[list_block(list)->num - 1] : NULL;
 }
 
 /*
@@ -290,18 +398,36 @@ void add_list(struct list **list, const char *name, int version)
 
 void free_list(struct list **list)
 {
-	struct list *new, *act;
-
-	if (list != NULL) {
-		act = (*list);
-		while(act != NULL) {
-			new = act->next;
-			if (act->name != NULL) {
-				free(act->name);
+	struct list_block *blk;
+	int ii;
+
+	if (list != NULL && *list != NULL) {
+		blk = list_block(*list);
+		for (ii = 0; ii < blk->num; ii++) {
+			if (blk->entries[ii].name != NULL) {
+				free(blk->entries[ii].name);
 			}
-			free(act);
-			act = new;
 		}
+		free(blk->latency);
+		free(blk);
+	}
+
+	if (list != NULL)
 		*list = NULL; /* Mark as done. */
+}
+
+/*
+ * Return 1 if the two lists have the same names in the same order, else 0.
+ */
+
+int same_list(const struct list *a, const struct list *b)
+{
+	while (a != NULL && b != NULL) {
+		if (strcmp(a->name, b->name) != 0)
+			return 0;
+		a = a->next;
+		b = b->next;
 	}
+
+	return (a == NULL && b == NULL);
 }
@@ -0,0 +1,233 @@
+/* > schedule.c
+ *
+ * Deadline scheduler for the main loop. Every check (and every entry of the
+ * configured lists) is an item in a binary min-heap keyed on its next absolute
+ * CLOCK_MONOTONIC deadline, so each can run on its own period and phase. The
+ * main loop simply pops whatever is due, runs it, and sleeps until the top of
+ * the heap is due again.
+ *
+ * Items with the same deadline come out in the order they were added, so the
+ * keep-alive tick (added first) still runs ahead of the checks and the lists
+ * are still checked in the order given in the configuration file.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define HEAP_CHUNK	32
+
+static struct sched_item *heap = NULL;
+static int heap_len = 0;
+static int heap_size = 0;
+static int next_order = 0;
+static struct timespec start_time;
+
+/*
+ * Return <0, 0 or >0 as item 'a' is due before, with or after item 'b'.
+ */
+
+static int item_cmp(const struct sched_item *a, const struct sched_item *b)
+{
+	if (a->due.tv_sec != b->due.tv_sec)
+		return (a->due.tv_sec < b->due.tv_sec) ? -1 : 1;
+
+	if (a->due.tv_nsec != b->due.tv_nsec)
+		return (a->due.tv_nsec < b->due.tv_nsec) ? -1 : 1;
+
+	return a->order - b->order;
+}
+
+static void sift_up(int ii)
+{
+	struct sched_item tmp = heap[ii];
+
+	while (ii > 0) {
+		int parent = (ii - 1) / 2;
+		if (item_cmp(&tmp, &heap[parent]) >= 0)
+			break;
+		heap[ii] = heap[parent];
+		ii = parent;
+	}
+
+	heap[ii] = tmp;
+}
+
+static void sift_down(int ii)
+{
+	struct sched_item tmp = heap[ii];
+
+	while (1) {
+		int child = 2 * ii + 1;
+		if (child >= heap_len)
+			break;
+		if (child + 1 < heap_len && item_cmp(&heap[child + 1], &heap[child]) < 0)
+			child++;
+		if (item_cmp(&heap[child], &tmp) >= 0)
+			break;
+		heap[ii] = heap[child];
+		ii = child;
+	}
+
+	heap[ii] = tmp;
+}
+
+static void push_item(const struct sched_item *item)
+{
+	if (heap_len >= heap_size) {
+		heap_size += HEAP_CHUNK;
+		heap = (struct sched_item *)realloc(heap, heap_size * sizeof(struct sched_item));
+		if (heap == NULL) {
+			fatal_error(EX_SYSERR, "out of memory for check schedule");
+		}
+	}
+
+	heap[heap_len] = *item;
+	sift_up(heap_len);
+	heap_len++;
+}
+
+/*
+ * Note the time the schedule starts from, phase offsets are relative to this.
+ */
+
+void sched_start(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+/*
+ * Add a check to the schedule. The 'period' is in seconds (must be >0), the 'phase'
+ * is the delay in seconds after sched_start() before the first run.
+ */
+
+void sched_add(int kind, struct list *act, int period, int phase)
+{
+	struct sched_item item;
+
+	memset(&item, 0, sizeof(item));
+	item.kind = kind;
+	item.act = act;
+	item.period = (period > 0) ? period : 1;
+	item.order = next_order++;
+	item.due = start_time;
+	item.due.tv_sec += phase;
+
+	push_item(&item);
+}
+
+/*
+ * Report the earliest deadline in the schedule. Returns -1 if it is empty.
+ */
+
+int sched_next(struct timespec *due)
+{
+	if (heap_len == 0)
+		return -1;
+
+	*due = heap[0].due;
+	return 0;
+}
+
+/*
+ * If the earliest item is due at 'now' (or before) remove it from the heap and copy
+ * it to 'item', returning 1. Otherwise return 0 and the heap is unchanged.
+ */
+
+int sched_pop_due(const struct timespec *now, struct sched_item *item)
+{
+	if (heap_len == 0)
+		return 0;
+
+	if (heap[0].due.tv_sec > now->tv_sec ||
+		(heap[0].due.tv_sec == now->tv_sec && heap[0].due.tv_nsec > now->tv_nsec))
+		return 0;
+
+	*item = heap[0];
+	heap_len--;
+	if (heap_len > 0) {
+		heap[0] = heap[heap_len];
+		sift_down(0);
+	}
+
+	return 1;
+}
+
+/*
+ * Put an item popped by sched_pop_due() back in for its next period. The new deadline
+ * is the old one plus the period so there is no drift, but if we have fallen more
+ * than one period behind we restart from 'now' rather than running a burst of
+ * catch-up checks. Returns the number of whole periods skipped.
+ */
+
+int sched_requeue(struct sched_item *item, const struct timespec *now)
+{
+	int skipped = 0;
+
+	item->due.tv_sec += item->period;
+	if (now->tv_sec > item->due.tv_sec + item->period) {
+		skipped = (int)((now->tv_sec - item->due.tv_sec) / item->period);
+		item->due = *now;
+		item->due.tv_sec += item->period;
+	}
+
+	push_item(item);
+
+	return skipped;
+}
+
+/*
+ * Put an item popped by sched_pop_due() back in unchanged, so it is still due and
+ * (as its place among items due together is kept) comes out again as it did.
+ */
+
+void sched_defer(const struct sched_item *item)
+{
+	push_item(item);
+}
+
+/*
+ * Make every item for 'act' (and 'kind') due at once. Its later runs then follow
+ * on from this one. Returns the number of items changed.
+ */
+
+int sched_run_now(int kind, const struct list *act)
+{
+	struct timespec now;
+	int ii, num = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (ii = 0; ii < heap_len; ii++) {
+		if (heap[ii].kind == kind && heap[ii].act == act) {
+			heap[ii].due = now;
+			sift_up(ii);
+			num++;
+		}
+	}
+
+	return num;
+}
+
+/*
+ * Release the schedule.
+ */
+
+void sched_free(void)
+{
+	if (heap != NULL) {
+		free(heap);
+	}
+
+	heap = NULL;
+	heap_len = heap_size = 0;
+	next_order = 0;
+}
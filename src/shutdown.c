@@ -128,13 +128,14 @@ void do_shutdown(int errorcode)
 
 static void close_all_but_watchdog(void)
 {
-	close_loadcheck();
-	close_memcheck();
-	close_tempcheck();
+	stop_keepalive_thread();	/* Refresh directly from here on. */
 	close_heartbeat();
-	close_netcheck(target_list);
+	close_stats();
+	close_metrics();
+	close_control();
+	close_checks();
+	close_event_loop();
 
-	free_process();		/* What check_bin() was waiting to report. */
 	free_all_lists();	/* Memory used by read_config() */
 }
 
@@ -0,0 +1,260 @@
+/* > stats.c
+ *
+ * Publish the daemon's live state in a memory-mapped file, normally under
+ * /dev/shm, with the layout in stats.h. Use wd_stat to read it.
+ *
+ * Only the main thread writes the segment, once per pass of the main loop and
+ * after any pooled checks have finished, so the entries can be copied straight
+ * from the configuration lists without further locking.
+ *
+ * Without a stats-file the same snapshot is kept in ordinary memory, as the
+ * metrics socket is served from it.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "extern.h"
+#include "read-conf.h"		/* For list_count() */
+#include "stats.h"
+
+struct ws_source {
+	struct list *act;
+	const char *kind;
+	int is_ping;
+};
+
+static struct ws_header *ws_map = NULL;
+static struct ws_entry *ws_entries = NULL;
+static size_t ws_map_size = 0;
+static int ws_mapped = FALSE;
+static char *ws_name = NULL;	/* File mapped, which a reload may have renamed in 'stats_file'. */
+static struct ws_source *sources = NULL;
+static int num_sources = 0;
+
+static void add_source(struct list *list, const char *kind, int is_ping)
+{
+	for (; list != NULL; list = list->next) {
+		sources[num_sources].act = list;
+		sources[num_sources].kind = kind;
+		sources[num_sources].is_ping = is_ping;
+		num_sources++;
+	}
+}
+
+/*
+ * Map the file named by 'stats_file', replacing any previous one. If there is
+ * none, or it can't be mapped, the snapshot is simply allocated.
+ */
+
+static struct ws_header *map_stats(size_t size)
+{
+	struct ws_header *map;
+	int fd;
+
+	ws_mapped = FALSE;
+	if (stats_file == NULL)
+		return (struct ws_header *)xcalloc(1, size);
+
+	fd = open(stats_file, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot create %s (errno = %d = '%s')", stats_file, err, strerror(err));
+		if (fd >= 0)
+			close(fd);
+		return (struct ws_header *)xcalloc(1, size);
+	}
+
+	map = (struct ws_header *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot map %s (errno = %d = '%s')", stats_file, err, strerror(err));
+		unlink(stats_file);
+		return (struct ws_header *)xcalloc(1, size);
+	}
+
+	ws_mapped = TRUE;
+	ws_name = xstrdup(stats_file);
+	return map;
+}
+
+/*
+ * Set up the snapshot with an entry for every configured check, in the
+ * 'stats_file' if there is one.
+ */
+
+int open_stats(void)
+{
+	struct timespec ts;
+	int64_t started = 0;
+	uint64_t loops = 0;
+	uint32_t max_loop_us = 0;
+	int ii, kind, num = 0;
+
+	/* After a reload the daemon's own totals carry on. */
+	if (ws_map != NULL) {
+		started = ws_map->started;
+		loops = ws_map->loops;
+		max_loop_us = ws_map->max_loop_us;
+	}
+
+	close_stats();
+
+	for (kind = 0; kind < CHECK_TYPES; kind++)
+		num += list_count(check_entries(kind));
+
+	sources = (struct ws_source *)xcalloc(num + 1, sizeof(struct ws_source));
+	num_sources = 0;
+	for (kind = 0; kind < CHECK_TYPES; kind++)
+		add_source(check_entries(kind), check_types[kind].name, kind == CHECK_PING);
+
+	ws_map_size = sizeof(struct ws_header) + num_sources * sizeof(struct ws_entry);
+
+	ws_map = map_stats(ws_map_size);
+	ws_entries = (struct ws_entry *)(ws_map + 1);
+
+	/* The names and kinds never change, so are only written once. */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ws_map->magic = WS_MAGIC;
+	ws_map->version = WS_VERSION;
+	ws_map->header_size = sizeof(struct ws_header);
+	ws_map->entry_size = sizeof(struct ws_entry);
+	ws_map->nentries = num_sources;
+	ws_map->pid = getpid();
+	ws_map->started = (started != 0) ? started : ts.tv_sec;
+	ws_map->loops = loops;
+	ws_map->max_loop_us = max_loop_us;
+	ws_map->interval = tint;
+	ws_map->min_margin_ms = ws_map->last_margin_ms = -1;
+
+	for (ii = 0; ii < num_sources; ii++) {
+		strncpy(ws_entries[ii].name, sources[ii].act->name, WS_NAME_LEN - 1);
+		strncpy(ws_entries[ii].kind, sources[ii].kind, WS_KIND_LEN - 1);
+		ws_entries[ii].rtt_us = -1;
+	}
+
+	if (verbose && ws_mapped)
+		log_message(LOG_DEBUG, "publishing statistics for %d check(s) in %s", num_sources, stats_file);
+
+	return 0;
+}
+
+static uint32_t clamp32(unsigned long val)
+{
+	return (val > 0xffffffffUL) ? 0xffffffffU : (uint32_t)val;
+}
+
+static void update_entry(struct ws_entry *ent, const struct ws_source *src)
+{
+	const struct list *act = src->act;
+
+	ent->last_result = act->last_result;
+	ent->last_latency_us = clamp32(act->last_latency);
+	ent->max_latency_us = clamp32(act->latency->max);
+	ent->repair_count = act->repair_count;
+	ent->checks = act->checks;
+	ent->errors = act->errors;
+	ent->last_time = act->last_time;
+
+	if (src->is_ping) {
+		const struct pingmode *net = &act->parameter.net;
+
+		ent->rtt_us = (net->srtt > 0) ? net->srtt : -1;
+		ent->rttvar_us = net->rttvar;
+		ent->lost = __builtin_popcountll(net->lost);
+		ent->sent = net->nsent;
+	}
+}
+
+/*
+ * Copy the current state in to the segment, called at the end of each pass of the
+ * main loop with the time the pass took in usec.
+ */
+
+void update_stats(unsigned long loop_us)
+{
+	struct ka_stats ka;
+	struct timespec ts;
+	int ii;
+
+	if (ws_map == NULL)
+		return;
+
+	keep_alive_stats(&ka);
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	ws_map->seq++;
+	__sync_synchronize();
+
+	ws_map->updated = ts.tv_sec;
+	ws_map->loops++;
+	ws_map->last_loop_us = clamp32(loop_us);
+	if (ws_map->last_loop_us > ws_map->max_loop_us)
+		ws_map->max_loop_us = ws_map->last_loop_us;
+	ws_map->timeout = (get_watchdog_fd() == -1) ? 0 : get_watchdog_timeout();
+	ws_map->refreshes = ka.refreshes;
+	ws_map->near_miss = ka.near_miss;
+	ws_map->min_margin_ms = ka.min_margin;
+	ws_map->last_margin_ms = ka.last_margin;
+	ws_map->hw_timeleft = ka.hw_timeleft;
+
+	for (ii = 0; ii < num_sources; ii++)
+		update_entry(&ws_entries[ii], &sources[ii]);
+
+	__sync_synchronize();
+	ws_map->seq++;
+}
+
+/*
+ * The latest snapshot, followed by its entries, or NULL if there is none. Only for
+ * use from the main thread.
+ */
+
+const struct ws_header *stats_snapshot(void)
+{
+	return ws_map;
+}
+
+/*
+ * Release the snapshot. The statistics file is removed so a reader can tell the
+ * daemon is gone.
+ */
+
+int close_stats(void)
+{
+	if (ws_map == NULL)
+		return -1;
+
+	if (ws_mapped) {
+		munmap(ws_map, ws_map_size);
+		if (unlink(ws_name) < 0) {
+			int err = errno;
+			log_message(LOG_ERR, "cannot remove %s (errno = %d = '%s')", ws_name, err, strerror(err));
+		}
+		free(ws_name);
+		ws_name = NULL;
+	} else {
+		free(ws_map);
+	}
+
+	ws_map = NULL;
+	ws_entries = NULL;
+	ws_mapped = FALSE;
+
+	free(sources);
+	sources = NULL;
+	num_sources = 0;
+
+	return 0;
+}
@@ -18,7 +18,7 @@ static int templevel1;
 static int templevel2;
 static int templevel3;
 
-static int read_temp_sensor(const char *name, int *val);
+static int read_temp_sensor(struct list *act, int *val);
 
 /* ================================================================= */
 
@@ -27,8 +27,6 @@ int open_tempcheck(struct list *tlist)
 	int rv = -1;
 	struct list *act;
 
-	close_tempcheck();
-
 	if (tlist != NULL) {
 		/* Use temp_fd as in-use flag. */
 		temp_fd = 0;
@@ -43,8 +41,14 @@ int open_tempcheck(struct list *tlist)
 			act->parameter.temp.have1 = FALSE;
 			act->parameter.temp.have2 = FALSE;
 			act->parameter.temp.have3 = FALSE;
-			/* Check the sensors is usable when initialising. */
-			if (read_temp_sensor(act->name, &itmp) == ENOERR) {
+			/* Keep the sensor open, and check it is usable when initialising. */
+			act->parameter.temp.fd = open(act->name, O_RDONLY | O_CLOEXEC);
+			if (act->parameter.temp.fd == -1) {
+				int err = errno;
+				log_message(LOG_ERR, "failed to open %s (%s)", act->name, strerror(err));
+			}
+
+			if (act->parameter.temp.fd != -1 && read_temp_sensor(act, &itmp) == ENOERR) {
 				act->parameter.temp.in_use = TRUE;
 			} else {
 				act->parameter.temp.in_use = FALSE;
@@ -94,36 +98,22 @@ int open_tempcheck(struct list *tlist)
  * for the watchdog tests below.
  */
 
-static int read_temp_sensor(const char *name, int *val)
+static int read_temp_sensor(struct list *act, int *val)
 {
 	float temp;
-	char buf[128];
-	char *p;
+	char buf[32];
 	int err;
-	FILE *fp;
 
-	fp = fopen(name, "r");
-	if (fp == NULL) {
-		err = errno;
-		log_message(LOG_ERR, "failed to open %s (%s)", name, strerror(err));
+	/* Read the sensor again from its start, it is only a few characters. */
+	err = proc_pread(act->parameter.temp.fd, act->name, buf, sizeof(buf));
+	if (err != ENOERR && err != EOVERFLOW)
 		return err;
-	}
-
-	buf[0] = 0; /* to be safe... */
-	p = fgets(buf, sizeof(buf)-1, fp);
-	err = errno;
-	fclose(fp);
-
-	if (p == NULL) {
-		log_message(LOG_ERR, "failed to read %s (%s)", name, strerror(err));
-		return err;
-	}
 
 	/* New style sensors read in milli-Celsius, convert to deg C as float. */
 	temp = 1.0e-3F * atof(buf);
 
 	if (verbose && logtick && ticker == 1)
-		log_message(LOG_DEBUG, "current temperature is %.3f for %s", temp, name);
+		log_message(LOG_DEBUG, "current temperature is %.3f for %s", temp, act->name);
 
 	/* convert to integer of whole deg C, small addition to make sure matches integer version. */
 	*val = (int)(1.0e-5F + temp);
@@ -142,7 +132,7 @@ int check_temp(struct list *act)
 	if (temp_fd == -1 || act == NULL || act->parameter.temp.in_use == FALSE)
 		return (ENOERR);
 
-	err = read_temp_sensor(act->name, &temperature);
+	err = read_temp_sensor(act, &temperature);
 	if (err != ENOERR) {
 		return (err);
 	}
@@ -183,11 +173,18 @@ int check_temp(struct list *act)
 
 /* ================================================================= */
 
-int close_tempcheck(void)
+int close_tempcheck(struct list *tlist)
 {
+	struct list *act;
 	int rv = -1;
 
 	if (temp_fd != -1) {
+		for (act = tlist; act != NULL; act = act->next) {
+			if (act->parameter.temp.fd != -1)
+				close(act->parameter.temp.fd);
+			act->parameter.temp.fd = -1;
+			act->parameter.temp.in_use = FALSE;
+		}
 		rv = 0;
 	}
 
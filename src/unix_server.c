@@ -0,0 +1,271 @@
+/* > unix_server.c
+ *
+ * The local Unix socket server shared by the metrics and control sockets. Each
+ * user fills in a 'struct unix_server' with how to tell a request is complete
+ * and how to answer it, and this does the rest: a fixed table of clients (the
+ * oldest being dropped when it is full), reading the request, and sending the
+ * answer as the socket allows.
+ *
+ * Everything runs from the main loop's event set and never blocks. A client gets
+ * one answer and is then disconnected.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE	/* For accept4() and struct ucred. */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "extern.h"
+#include "timefunc.h"
+
+static void client_event(int fd, unsigned int events, void *ptr);
+
+static void drop_client(struct server_client *c)
+{
+	event_del_fd(c->fd);
+	close(c->fd);
+
+	if (c->writing && c->srv->release != NULL)
+		(*c->srv->release) (c);
+
+	c->fd = -1;
+	c->writing = c->want_out = FALSE;
+	c->len = c->sent = c->out_len = 0;
+	c->out = NULL;
+}
+
+/*
+ * Send as much of the answer as the socket will take, waiting for it to be
+ * writable again if need be. The client is dropped once it has all of it.
+ */
+
+static void send_more(struct server_client *c)
+{
+	while (c->sent < c->out_len) {
+		ssize_t len = send(c->fd, c->out + c->sent, c->out_len - c->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (!c->want_out) {
+					event_del_fd(c->fd);
+					if (event_add_fd(c->fd, EPOLLOUT, client_event, c) < 0) {
+						drop_client(c);
+						return;
+					}
+					c->want_out = TRUE;
+				}
+				return;
+			}
+			break;
+		}
+
+		c->sent += len;
+	}
+
+	drop_client(c);
+}
+
+static void client_event(int fd, unsigned int events, void *ptr)
+{
+	struct server_client *c = (struct server_client *)ptr;
+
+	if (!c->writing) {
+		ssize_t len = read(fd, c->in + c->len, SERVER_IN_SIZE - 1 - c->len);
+
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				drop_client(c);
+			return;
+		}
+
+		c->len += len;
+		c->in[c->len] = '\0';
+
+		/* Wait for the whole request, unless the client is done or out of room. */
+		if (len > 0 && c->len < SERVER_IN_SIZE - 1 && !(*c->srv->complete) (c->in))
+			return;
+
+		(*c->srv->respond) (c);
+		c->writing = TRUE;
+	}
+
+	send_more(c);
+}
+
+/*
+ * Is the peer on 'fd' allowed to connect to a private server? Its pid and uid are
+ * left in 'c'.
+ */
+
+static int allowed_peer(struct unix_server *srv, int fd, struct server_client *c)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot get %s client credentials (errno = %d = '%s')", srv->what, err, strerror(err));
+		return FALSE;
+	}
+
+	c->pid = (int)cred.pid;
+	c->uid = (int)cred.uid;
+
+	if (cred.uid == 0 || cred.uid == geteuid())
+		return TRUE;
+
+	log_message(LOG_WARNING, "%s connection refused for pid %d uid %d", srv->what, c->pid, c->uid);
+	return FALSE;
+}
+
+/*
+ * Take new connections, dropping the oldest client if the table is full.
+ */
+
+static void listen_event(int fd, unsigned int events, void *ptr)
+{
+	struct unix_server *srv = (struct unix_server *)ptr;
+	int cfd;
+
+	while ((cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		struct server_client peer, *c = NULL;
+		int ii;
+
+		peer.pid = peer.uid = -1;
+		if (srv->private && !allowed_peer(srv, cfd, &peer)) {
+			if (srv->denied != NULL &&
+			    send(cfd, srv->denied, strlen(srv->denied), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+				/* Nothing more we can tell them. */
+			}
+			close(cfd);
+			continue;
+		}
+
+		for (ii = 0; ii < srv->max_clients; ii++) {
+			if (srv->clients[ii].fd == -1) {
+				c = &srv->clients[ii];
+				break;
+			}
+			if (c == NULL || srv->clients[ii].opened < c->opened)
+				c = &srv->clients[ii];
+		}
+
+		if (c->fd != -1)
+			drop_client(c);
+
+		c->fd = cfd;
+		c->pid = peer.pid;
+		c->uid = peer.uid;
+		c->opened = time_mono(NULL);
+		if (event_add_fd(cfd, EPOLLIN, client_event, c) < 0) {
+			close(cfd);
+			c->fd = -1;
+		}
+	}
+}
+
+/*
+ * Create the socket 'name' for 'srv' and serve it from the event loop. A private
+ * server's socket is only accessible to the daemon's user, and only root or that
+ * user may connect. Returns 0 or -1.
+ */
+
+int server_open(struct unix_server *srv, const char *name)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	mode_t old_mask;
+	int ii, rv;
+
+	server_close(srv);
+
+	if (strlen(name) >= sizeof(addr.sun_path)) {
+		log_message(LOG_ERR, "%s-socket name %s is too long", srv->what, name);
+		return -1;
+	}
+
+	/* Only ever remove an old socket, not some other file given by mistake. */
+	if (lstat(name, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(name);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, name);
+
+	srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (srv->listen_fd < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot create %s socket (errno = %d = '%s')", srv->what, err, strerror(err));
+		return -1;
+	}
+
+	/* Create a private one with no access for anyone else, rather than fix that up afterwards. */
+	if (srv->private) {
+		old_mask = umask(0177);
+		rv = bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+		umask(old_mask);
+	} else {
+		rv = bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+	}
+
+	if (rv < 0 || listen(srv->listen_fd, srv->max_clients) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot listen on %s (errno = %d = '%s')", name, err, strerror(err));
+		close(srv->listen_fd);
+		return -1;
+	}
+
+	if (event_add_fd(srv->listen_fd, EPOLLIN, listen_event, srv) < 0) {
+		log_message(LOG_ERR, "cannot serve %s without the event loop", name);
+		close(srv->listen_fd);
+		unlink(name);
+		return -1;
+	}
+
+	srv->clients = (struct server_client *)xcalloc(srv->max_clients, sizeof(struct server_client));
+	for (ii = 0; ii < srv->max_clients; ii++) {
+		srv->clients[ii].srv = srv;
+		srv->clients[ii].fd = -1;
+	}
+
+	/* Removed on close, even if the configuration has changed. */
+	srv->name = xstrdup(name);
+	return 0;
+}
+
+int server_close(struct unix_server *srv)
+{
+	int ii;
+
+	if (srv->name == NULL)
+		return -1;
+
+	for (ii = 0; ii < srv->max_clients; ii++) {
+		if (srv->clients[ii].fd != -1)
+			drop_client(&srv->clients[ii]);
+	}
+
+	event_del_fd(srv->listen_fd);
+	close(srv->listen_fd);
+	unlink(srv->name);
+	free(srv->name);
+	srv->name = NULL;
+	free(srv->clients);
+	srv->clients = NULL;
+
+	return 0;
+}
@@ -18,16 +18,27 @@
 #include <string.h>
 #include <time.h>
 #include <libgen.h>
+#include <limits.h>
 #include <unistd.h>
-#include <sys/param.h>		/* For EXEC_PAGESIZE */
 
 #include "watch_err.h"
 #include "extern.h"
-#include "read-conf.h"		/* For add_list() */
+#include "read-conf.h"		/* For list_count() */
 #include "timefunc.h"
+#include "stats.h"
 
 static int no_act = FALSE;
 
+/* Only the device is refreshed while set, from the control socket. */
+static int maintenance = FALSE;
+
+/* Latency histogram in usec for a whole loop pass, those of the checks are in check_types[]. */
+static struct histogram loop_latency;
+static volatile sig_atomic_t dump_latency = FALSE;
+static volatile sig_atomic_t reload_pending = FALSE;
+
+#define BUDGET_DEFER	75	/* Percent of the loop budget used before remaining checks are deferred. */
+
 static void usage(char *progname)
 {
 	fprintf(stderr, "%s version %d.%d, usage:\n", progname, MAJOR_VERSION, MINOR_VERSION);
@@ -37,6 +48,7 @@ static void usage(char *progname)
 	fprintf(stderr, "  -f | --force               don't sanity-check config or use PID file\n");
 	fprintf(stderr, "  -F | --foreground          run in foreground\n");
 	fprintf(stderr, "  -X | --loop-exit <number>  run a fixed number of loops then exit\n");
+	fprintf(stderr, "  -P | --profile <number>    run every check this many times and report the cost\n");
 	fprintf(stderr, "  -q | --no-action           do not reboot or halt\n");
 	fprintf(stderr, "  -b | --softboot            soft-boot on error\n");
 	fprintf(stderr, "  -s | --sync                sync filesystem\n");
@@ -84,6 +96,7 @@ static int repair(char *rbinary, int result, char *name, int version)
 		return (result);
 
 	ret = run_func_as_child(repair_timeout, exec_as_func, FLAG_REOPEN_STD_REPAIR, arg);
+	metrics_repair(ret);
 
 	/* check result */
 	if (ret != 0) {
@@ -202,73 +215,637 @@ static void wd_action(int result, char *rbinary, struct list *act)
 
 static void do_check(int res, char *rbinary, struct list *act)
 {
+	if (res != ENOERR)
+		metrics_check_failed(res);
+
 	wd_action(res, rbinary, act);
 	wd_action(keep_alive(), rbinary, NULL);
 }
 
-static void old_option(int c, char *configfile)
+/*
+ * Called from the event loop when a child process exits, collect any test
+ * binary result now (and reap the zombie) so it is ready for the next check.
+ */
+
+static void child_event(int fd, unsigned int events, void *ptr)
 {
-	fprintf(stderr, "Option -%c is no longer valid, please specify it in %s.\n", c, configfile);
+	check_bin(NULL, test_timeout, 0);
 }
 
-static void print_info(int sync_it, int force)
+/*
+ * Name of a scheduled check for log messages.
+ */
+
+static const char *check_name(const struct sched_item *item)
+{
+	if (item->kind < 0 || item->kind >= CHECK_TYPES)
+		return "unknown";
+
+	/* A single check's own entry is only there for the retry timer. */
+	if (item->act != NULL && check_types[item->kind].list != NULL)
+		return item->act->name;
+
+	return check_types[item->kind].name;
+}
+
+/*
+ * Put the keep-alive tick and every configured check in to the schedule. The tick
+ * goes in first so at any given time it runs ahead of the checks.
+ */
+
+static void build_schedule(void)
 {
 	struct list *act;
+	int kind;
 
-	log_message(LOG_INFO, "int=%ds realtime=%s sync=%s load=%d,%d,%d",
-		    tint,
-		    realtime ? "yes" : "no",
-		    sync_it ? "yes" : "no",
-		    maxload1, maxload5, maxload15);
+	sched_start();
 
-	if (minpages == 0 && minalloc == 0)
-		log_message(LOG_INFO, "memory not checked");
-	else
-		log_message(LOG_INFO, "memory: minimum pages = %d free, %d allocatable (%d byte pages)",
-			minpages, minalloc, EXEC_PAGESIZE);
+	sched_add(CHECK_TICK, NULL, tint, 0);
 
-	if (target_list == NULL)
-		log_message(LOG_INFO, "ping: no machine to check");
-	else
-		for (act = target_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "ping: %s", act->name);
+	for (kind = CHECK_TICK + 1; kind < CHECK_TYPES; kind++) {
+		for (act = check_entries(kind); act != NULL; act = act->next)
+			sched_add(kind, act, check_period(kind, act), act->phase);
+	}
+}
 
-	if (file_list == NULL)
-		log_message(LOG_INFO, "file: no file to check");
-	else
-		for (act = file_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "file: %s:%d", act->name, act->parameter.file.mtime);
+/*
+ * Checks that only look at their own list entry, so can be run on the worker
+ * pool alongside each other.
+ */
 
-	if (pidfile_list == NULL)
-		log_message(LOG_INFO, "pidfile: no server process to check");
-	else
-		for (act = pidfile_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "pidfile: %s", act->name);
+static int independent_check(int kind)
+{
+	return (check_types[kind].flags & CHECK_POOLED) != 0;
+}
 
-	if (iface_list == NULL)
-		log_message(LOG_INFO, "interface: no interface to check");
-	else
-		for (act = iface_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "interface: %s", act->name);
+/*
+ * Run one check popped from the schedule.
+ */
 
-	if (temp_list == NULL)
-		log_message(LOG_INFO, "temperature: no sensors to check");
-	else {
-		log_message(LOG_INFO, "temperature: maximum = %d", maxtemp);
-		for (act = temp_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "temperature: %s", act->name);
+static void run_check(struct sched_item *item)
+{
+	long took;
+	int res;
+
+	res = time_check(item->kind, item->act, &took);
+	account_check(item->kind, item->act, res, took);
+	do_check(res, repair_bin, item->act);
+}
+
+/*
+ * Put a check back in the schedule for its next period.
+ */
+
+static void requeue_check(struct sched_item *item)
+{
+	struct timespec now;
+	int skipped;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	skipped = sched_requeue(item, &now);
+	if (skipped > 0) {
+		if (item->kind == CHECK_TICK) {
+			log_message(LOG_WARNING, "checks overran, skipped %d interval(s)", skipped);
+		} else if (verbose) {
+			log_message(LOG_DEBUG, "%s check overran, skipped %d period(s)", check_name(item), skipped);
+		}
 	}
+}
 
-	if (tr_bin_list == NULL)
-		log_message(LOG_INFO, "no test binary files");
-	else {
-		log_message(LOG_INFO, "test binary time-out = %d", test_timeout);
-		for (act = tr_bin_list; act != NULL; act = act->next)
-			log_message(LOG_INFO, "%s: %s",
-				act->version == 0 ? "test binary V0" : "test/repair V1",
-				act->name);
+/*
+ * Milliseconds from 'from' to 'to' (both CLOCK_MONOTONIC).
+ */
+
+static long ms_between(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+static long us_between(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000L;
+}
+
+static long us_since(const struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return us_between(from, &now);
+}
+
+static long ms_since(const struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ms_between(from, &now);
+}
+
+static void sigusr1_handler(int arg)
+{
+	dump_latency = TRUE;
+}
+
+static void sighup_handler(int arg)
+{
+	reload_pending = TRUE;
+	event_break();
+}
+
+/*
+ * Write all of the latency histograms to 'latency' in the log directory. The file
+ * is written under another name and renamed so a reader never sees half of it.
+ */
+
+static void write_latency(void)
+{
+	char fname[PATH_MAX], tname[PATH_MAX], label[64];
+	struct histogram spacing;
+	struct ka_stats ka;
+	struct list *act;
+	FILE *fp;
+	int kind;
+
+	snprintf(fname, sizeof(fname), "%s/latency", logdir);
+	snprintf(tname, sizeof(tname), "%s/latency.new", logdir);
+
+	if ((fp = fopen(tname, "w")) == NULL) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", tname, err, strerror(err));
+		return;
+	}
+
+	fprintf(fp, "# %-30s %10s %10s %10s %10s %10s %10s %10s\n", "usec", "count", "min", "p50", "p90", "p99", "max", "mean");
+	hist_write(fp, "loop", &loop_latency);
+
+	keep_alive_spacing(&spacing);
+	hist_write(fp, "keep-alive-spacing", &spacing);
+
+	keep_alive_stats(&ka);
+	hist_write(fp, "refresh-spacing", &ka.spacing);
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		if (check_types[kind].latency.count > 0) {
+			snprintf(label, sizeof(label), "type:%s", check_types[kind].name);
+			hist_write(fp, label, &check_types[kind].latency);
+		}
+	}
+
+	/* Single checks are already covered by their kind. */
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		if (check_types[kind].list == NULL)
+			continue;
+		for (act = check_entries(kind); act != NULL; act = act->next)
+			hist_write(fp, act->name, act->latency);
+	}
+
+	if (fclose(fp) == EOF || rename(tname, fname) < 0) {
+		int err = errno;
+		log_message(LOG_ERR, "cannot write %s (errno = %d = '%s')", fname, err, strerror(err));
+		unlink(tname);
+	} else if (verbose) {
+		log_message(LOG_DEBUG, "latency histograms written to %s", fname);
+	}
+}
+
+/*
+ * The time in milliseconds one pass of the main loop may take. The device is
+ * refreshed at the start of a pass and the next is due <interval> later, so the
+ * rest of the hardware time-out is the safety margin the checks can use up.
+ */
+
+static long loop_budget(void)
+{
+	int timeout = (get_watchdog_fd() == -1) ? dev_timeout : get_watchdog_timeout();
+	long budget = (long)(timeout - tint) * 1000L;
+
+	/* With an interval as long as the time-out, settle for half of it. */
+	if (budget <= 0)
+		budget = timeout * 500L;
+
+	return budget;
+}
+
+/*
+ * Returns TRUE once BUDGET_DEFER percent of the loop budget is gone, 'used' being
+ * the time since the pass started, having refreshed the device, so the caller
+ * leaves the remaining checks for the next pass.
+ */
+
+static int budget_spent(long used)
+{
+	if (used * 100 < loop_budget() * BUDGET_DEFER)
+		return FALSE;
+
+	/* Refresh now rather than wait for the tick, then get back to the schedule. */
+	wd_action(keep_alive(), repair_bin, NULL);
+	return TRUE;
+}
+
+/*
+ * Charge a check that took 'took' ms to the loop budget, 'used' being the time
+ * since the pass started. Any overrun is logged against the check. Returns as
+ * budget_spent() does.
+ */
+
+static int charge_budget(const char *name, long took, long used)
+{
+	long budget = loop_budget();
+
+	if (used >= budget && used - took < budget) {
+		log_message(LOG_WARNING, "loop budget of %ldms used up by %s (took %ldms, loop at %ldms)",
+			    budget, name, took, used);
+	}
+
+	return budget_spent(used);
+}
+
+/* The entries of a batch, as passed to the worker pool, and their results. */
+struct batch_job {
+	int kind;
+	struct list **act;
+	int *res;
+	int num;
+	long took;			/* Microseconds taken. */
+};
+
+/* An independent check handed to the worker pool, and its result. */
+struct check_job {
+	struct sched_item item;
+	int result;
+	long took;
+};
+
+/* Room for every batched entry (the ping targets) and pooled check being due in the same pass. */
+static struct sched_item *batch_items = NULL;
+static struct list **batch_act = NULL;
+static int *batch_res = NULL;
+static struct check_job *check_jobs = NULL;
+
+static void alloc_batches(void)
+{
+	int kind, num_batched = 0, num_pooled = 0;
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		if (check_types[kind].flags & CHECK_BATCHED)
+			num_batched += list_count(check_entries(kind));
+		if (check_types[kind].flags & CHECK_POOLED)
+			num_pooled += list_count(check_entries(kind));
+	}
+
+	free(batch_items);
+	free(batch_act);
+	free(batch_res);
+	free(check_jobs);
+
+	batch_items = (struct sched_item *)xcalloc(num_batched + 1, sizeof(struct sched_item));
+	batch_act = (struct list **)xcalloc(num_batched + 1, sizeof(struct list *));
+	batch_res = (int *)xcalloc(num_batched + 1, sizeof(int));
+	check_jobs = (struct check_job *)xcalloc(num_pooled + 1, sizeof(struct check_job));
+}
+
+/*
+ * Can 'item' join the batch of 'num' items so far? Only entries of the same
+ * batched kind are checked together.
+ */
+
+static int joins_batch(const struct sched_item *item, int num)
+{
+	if (!(check_types[item->kind].flags & CHECK_BATCHED))
+		return FALSE;
+
+	return (num == 0 || batch_items[0].kind == item->kind);
+}
+
+static void batch_job_func(void *ptr)
+{
+	struct batch_job *job = (struct batch_job *)ptr;
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	(*check_types[job->kind].check_batch) (job->act, job->res, job->num);
+	job->took = us_since(&start);
+}
+
+static void check_job_func(void *ptr)
+{
+	struct check_job *job = (struct check_job *)ptr;
+
+	job->result = time_check(job->item.kind, job->item.act, &job->took);
+}
+
+static void start_batch(struct sched_item batch[], int num, struct batch_job *job)
+{
+	int ii;
+
+	for (ii = 0; ii < num; ii++)
+		batch_act[ii] = batch[ii].act;
+
+	job->kind = batch[0].kind;
+	job->act = batch_act;
+	job->res = batch_res;
+	job->num = num;
+}
+
+static void finish_batch(struct sched_item batch[], struct batch_job *job)
+{
+	int ii;
+
+	account_batch(job->kind, job->act, job->res, job->num, job->took);
+
+	for (ii = 0; ii < job->num; ii++) {
+		do_check(job->res[ii], repair_bin, job->act[ii]);
+		requeue_check(&batch[ii]);
+	}
+}
+
+/*
+ * Check all of the entries that came due together, so N ping targets cost one
+ * reply time-out rather than N of them, then act on each result in turn.
+ */
+
+static void run_batch(struct sched_item batch[], int num, const struct timespec *loop_start)
+{
+	struct batch_job job;
+
+	start_batch(batch, num, &job);
+	batch_job_func(&job);
+	finish_batch(batch, &job);
+
+	charge_budget(check_types[job.kind].name, job.took / 1000, ms_since(loop_start));
+}
+
+/*
+ * Run the independent checks in 'jobs' and any batch together on the worker
+ * pool, so this costs about as long as the slowest of them. Once all are done
+ * act on each result in turn from the main thread, as run_check() would.
+ */
+
+static void run_pooled_checks(struct check_job jobs[], int num_jobs, struct sched_item batch[], int num_batch,
+			      const struct timespec *loop_start)
+{
+	struct batch_job job;
+	const char *slowest = "";
+	long took = 0;
+	int ii;
+
+	/* The batch first, as it normally takes longest. */
+	if (num_batch > 0) {
+		start_batch(batch, num_batch, &job);
+		workers_submit(batch_job_func, &job);
+	}
+
+	for (ii = 0; ii < num_jobs; ii++)
+		workers_submit(check_job_func, &jobs[ii]);
+
+	workers_wait();
+
+	for (ii = 0; ii < num_jobs; ii++) {
+		account_check(jobs[ii].item.kind, jobs[ii].item.act, jobs[ii].result, jobs[ii].took);
+		do_check(jobs[ii].result, repair_bin, jobs[ii].item.act);
+		requeue_check(&jobs[ii].item);
+	}
+
+	if (num_batch > 0) {
+		finish_batch(batch, &job);
+		took = job.took;
+		slowest = check_types[job.kind].name;
+	}
+
+	/* The batch cost as long as its slowest check, so that gets the blame. */
+	for (ii = 0; ii < num_jobs; ii++) {
+		if (jobs[ii].took > took) {
+			took = jobs[ii].took;
+			slowest = check_name(&jobs[ii].item);
+		}
+	}
+
+	charge_budget(slowest, took / 1000, ms_since(loop_start));
+}
+
+/*
+ * Put the checks collected for a batch or the worker pool back in the schedule
+ * as they were, so they are still due and the next pass runs them.
+ */
+
+static void defer_collected(struct check_job jobs[], int num_jobs, struct sched_item batch[], int num_batch)
+{
+	int ii;
+
+	for (ii = 0; ii < num_batch; ii++)
+		sched_defer(&batch[ii]);
+
+	for (ii = 0; ii < num_jobs; ii++)
+		sched_defer(&jobs[ii].item);
+
+	if (verbose)
+		log_message(LOG_DEBUG, "loop budget nearly used, deferring %d batched and %d pooled check(s)",
+			    num_batch, num_jobs);
+}
+
+/*
+ * Log any check periods that are not simply the main 'interval'.
+ */
+
+static void print_schedule(void)
+{
+	char buf[256];
+	size_t len = 0;
+	struct list *act;
+	int kind;
+
+	buf[0] = '\0';
+	for (kind = CHECK_TICK + 1; kind < CHECK_TYPES && len < sizeof(buf); kind++)
+		len += snprintf(buf + len, sizeof(buf) - len, " %s=%ds", check_types[kind].name, check_period(kind, NULL));
+
+	log_message(LOG_INFO, "check intervals:%s", buf);
+
+	for (kind = CHECK_TICK + 1; kind < CHECK_TYPES; kind++) {
+		for (act = check_entries(kind); act != NULL; act = act->next) {
+			if (act->interval > 0 || act->phase > 0)
+				log_message(LOG_INFO, "%s: check-interval=%ds check-phase=%ds",
+					    act->name, act->interval, act->phase);
+		}
+	}
+}
+
+/* Returns FALSE if the entry was left as it is. */
+typedef int (*entry_func)(int kind, struct list *act);
+
+/*
+ * Call 'func' for every scheduled entry that 'name' picks out: "all", a kind of
+ * check such as "ping", or the name of a single entry. Returns how many it acted
+ * on, and counts those it left alone in '*skipped' if that is non-NULL.
+ */
+
+static int for_entries(const char *name, entry_func func, int *skipped)
+{
+	int kind, num = 0;
+
+	if (skipped != NULL)
+		*skipped = 0;
+
+	for (kind = CHECK_TICK + 1; kind < CHECK_TYPES; kind++) {
+		struct list *act;
+
+		for (act = check_entries(kind); act != NULL; act = act->next) {
+			if (strcmp(name, "all") == 0 || strcmp(name, check_types[kind].name) == 0 ||
+			    strcmp(name, act->name) == 0) {
+				if ((*func) (kind, act))
+					num++;
+				else if (skipped != NULL)
+					(*skipped)++;
+			}
+		}
 	}
 
+	return num;
+}
+
+/* A paused entry would only be put back on its period, so is not made due. */
+static int entry_run_now(int kind, struct list *act)
+{
+	if (act->paused)
+		return FALSE;
+
+	sched_run_now(kind, act);
+	return TRUE;
+}
+
+static int entry_pause(int kind, struct list *act)
+{
+	act->paused = TRUE;
+	return TRUE;
+}
+
+static int entry_resume(int kind, struct list *act)
+{
+	act->paused = FALSE;
+	return TRUE;
+}
+
+static int entry_reset(int kind, struct list *act)
+{
+	act->last_time = 0;
+	act->repair_count = 0;
+	return TRUE;
+}
+
+static int entry_dump(int kind, struct list *act)
+{
+	control_reply("%s %s%s checks=%lu errors=%lu result=%d retry=%lds repairs=%d latency=%ldus\n",
+		      check_types[kind].name, act->name, act->paused ? " (paused)" : "", act->checks, act->errors,
+		      act->last_result, (act->last_time != 0) ? (long)(time_mono(NULL) - act->last_time) : -1L,
+		      act->repair_count, act->last_latency);
+	return TRUE;
+}
+
+/*
+ * Carry out a command from the control socket. This is called from the event
+ * loop, so only ever changes state for the main loop to act on.
+ */
+
+static void control_command(const char *cmd, const char *arg)
+{
+	static const struct {
+		const char *cmd;
+		entry_func func;
+		const char *done;
+	} entry_cmds[] = {
+		{"check", entry_run_now, "due now"},
+		{"pause", entry_pause, "paused"},
+		{"resume", entry_resume, "resumed"},
+		{"reset", entry_reset, "reset"},
+	};
+	const struct ws_header *hdr = stats_snapshot();
+	int ii, num, skipped;
+
+	for (ii = 0; ii < (int)(sizeof(entry_cmds) / sizeof(entry_cmds[0])); ii++) {
+		if (strcmp(cmd, entry_cmds[ii].cmd) != 0)
+			continue;
+
+		if (*arg == '\0') {
+			control_reply("error: %s needs a check name, a kind of check or 'all'\n", cmd);
+			return;
+		}
+
+		if (entry_cmds[ii].func == entry_run_now && maintenance) {
+			control_reply("error: no checks are run in maintenance mode\n");
+			return;
+		}
+
+		num = for_entries(arg, entry_cmds[ii].func, &skipped);
+		if (num == 0 && skipped == 0) {
+			control_reply("error: no check matches '%s'\n", arg);
+			return;
+		}
+
+		if (num == 0) {
+			control_reply("error: %d check(s) matching '%s' paused, resume them first\n", skipped, arg);
+			return;
+		}
+
+		/* The main loop may be waiting for a later deadline. */
+		if (entry_cmds[ii].func == entry_run_now)
+			event_break();
+
+		log_message(LOG_NOTICE, "%d check(s) %s by control command", num, entry_cmds[ii].done);
+		if (skipped > 0)
+			control_reply("ok: %d check(s) %s, %d paused ones left\n", num, entry_cmds[ii].done, skipped);
+		else
+			control_reply("ok: %d check(s) %s\n", num, entry_cmds[ii].done);
+		return;
+	}
+
+	if (strcmp(cmd, "maintenance") == 0) {
+		if (strcmp(arg, "on") == 0) {
+			maintenance = TRUE;
+		} else if (strcmp(arg, "off") == 0) {
+			maintenance = FALSE;
+		} else {
+			control_reply("error: maintenance needs 'on' or 'off'\n");
+			return;
+		}
+
+		log_message(LOG_NOTICE, "maintenance mode %s, %s", arg,
+			    maintenance ? "only refreshing the watchdog device" : "checks resumed");
+		control_reply("ok: maintenance %s\n", arg);
+	} else if (strcmp(cmd, "dump") == 0) {
+		control_reply("mode: %s\n", maintenance ? "maintenance" : "normal");
+		if (hdr != NULL)
+			control_reply("loops: %llu, last took %uus, longest %uus\n",
+				      (unsigned long long)hdr->loops, hdr->last_loop_us, hdr->max_loop_us);
+		control_reply("device: %s\n", (get_watchdog_fd() == -1) ? "not open" : devname);
+		for_entries((*arg) ? arg : "all", entry_dump, NULL);
+	} else if (strcmp(cmd, "help") == 0) {
+		control_reply("check <name>        run the check(s) now\n"
+			      "pause <name>        stop running the check(s)\n"
+			      "resume <name>       run paused check(s) again\n"
+			      "reset <name>        clear the retry timer and repair count\n"
+			      "maintenance on|off  only refresh the watchdog device while on\n"
+			      "dump [<name>]       show the daemon's state\n"
+			      "<name> is a check's name, a kind of check (e.g. 'ping') or 'all'\n");
+	} else {
+		control_reply("error: unknown command '%s', try 'help'\n", cmd);
+	}
+}
+
+static void old_option(int c, char *configfile)
+{
+	fprintf(stderr, "Option -%c is no longer valid, please specify it in %s.\n", c, configfile);
+}
+
+static void print_info(int sync_it, int force)
+{
+	log_message(LOG_INFO, "int=%ds realtime=%s sync=%s load=%d,%d,%d",
+		    tint,
+		    realtime ? "yes" : "no",
+		    sync_it ? "yes" : "no",
+		    maxload1, maxload5, maxload15);
+
+	describe_checks();
+
 	if (repair_bin == NULL)
 		log_message(LOG_INFO, "no repair binary files");
 	else {
@@ -276,6 +853,8 @@ static void print_info(int sync_it, int force)
 		log_message(LOG_INFO, "repair binary: program = %s", repair_bin);
 	}
 
+	print_schedule();
+
 	log_message(LOG_INFO, "error retry time-out = %d seconds", retry_timeout);
 
 	if (repair_max > 0) {
@@ -284,6 +863,13 @@ static void print_info(int sync_it, int force)
 		log_message(LOG_INFO, "repair attempts = unlimited");
 	}
 
+	if (ka_thread_mode) {
+		log_message(LOG_INFO, "keep-alive thread: stale limit = %d seconds",
+			(ka_stale > 0) ? ka_stale : dev_timeout);
+	} else {
+		log_message(LOG_INFO, "keep-alive: at most every %dms", ka_spacing);
+	}
+
 	log_message(LOG_INFO, "alive=%s heartbeat=%s to=%s no_act=%s force=%s",
 		    (devname == NULL) ? "[none]" : devname,
 		    (heartbeat == NULL) ? "[none]" : heartbeat,
@@ -297,7 +883,7 @@ static void print_info(int sync_it, int force)
  * the message about using the --force option to skip these checks.
  */
 
-static void check_parameters(void)
+static int check_parameters(void)
 {
 	int err = 0;
 	int min_timeout = 1;
@@ -369,18 +955,309 @@ static void check_parameters(void)
 		err = 1;
 	}
 
-	if (err) {
-		fatal_error(EX_USAGE, "To force parameter(s) use the --force command line option.");
+	return err;
+}
+
+/*
+ * Take up the configuration file again, on SIGHUP. Only what has changed is opened
+ * or closed, the watchdog device stays open throughout, and checks still in the
+ * file keep their retry timers and repair counts. If the new settings would not
+ * pass the start-up checks the running ones are kept.
+ */
+
+static void reload_config(char *configfile, int sync_it, int force)
+{
+	struct config_lists old;
+	char *was_heartbeat = heartbeat;
+	int was_hbstamps = hbstamps, was_hb_binary = hb_binary;
+
+	log_message(LOG_NOTICE, "reloading %s", configfile);
+
+	if (reread_config(configfile, &old) < 0) {
+		log_message(LOG_ERR, "configuration not reloaded, keeping the current settings");
+		return;
+	}
+
+	if ((!force && check_parameters()) || valid_checks() < 0) {
+		log_message(LOG_ERR, "configuration not reloaded, keeping the current settings");
+		revert_config(&old);
+		return;
+	}
+
+	reopen_checks();
+
+	if ((heartbeat == NULL) != (was_heartbeat == NULL) ||
+	    (heartbeat != NULL && strcmp(heartbeat, was_heartbeat) != 0) ||
+	    hbstamps != was_hbstamps || hb_binary != was_hb_binary)
+		reopen_heartbeat();
+
+	/* Everything referring to the old entries is rebuilt before they go. */
+	sched_free();
+	build_schedule();
+	alloc_batches();
+	open_stats();
+	open_metrics(&loop_latency);
+	open_control(control_command);
+	free_config_lists(&old);
+
+	print_info(sync_it, force);
+	log_message(LOG_NOTICE, "configuration reloaded");
+}
+
+/* What one scheduled check cost over all of its --profile runs. */
+struct profile_row {
+	struct sched_item item;
+	unsigned long long syscalls;
+	unsigned long forks;
+	unsigned long failed;
+};
+
+static const char profile_fmt[] = "%-36s %8s %8s %8s %9s %6s %6s\n";
+static const char profile_row_fmt[] = "%-36.36s %8lu %8lu %8lu %9s %6s %6lu\n";
+
+/*
+ * Add the cost since 'before', less the cost of measuring it, to 'row' and (if
+ * not NULL) to 'also'.
+ */
+
+static void charge_row(struct profile_row *row, struct profile_row *also, const struct cost *before,
+		       const struct cost *overhead)
+{
+	unsigned long long syscalls = 0;
+	struct cost after;
+
+	read_cost(&after);
+	if (after.syscalls - before->syscalls > overhead->syscalls)
+		syscalls = after.syscalls - before->syscalls - overhead->syscalls;
+
+	row->syscalls += syscalls;
+	row->forks += after.forks - before->forks;
+	if (also != NULL) {
+		also->syscalls += syscalls;
+		also->forks += after.forks - before->forks;
+	}
+}
+
+/*
+ * Run the check in 'row' once for --profile, as the main loop would but with no
+ * action taken on the result. Its cost goes to the row and to its kind in 'kinds'.
+ */
+
+static void profile_check(struct profile_row *row, struct profile_row kinds[], int sync_it,
+			  const struct cost *overhead)
+{
+	struct sched_item *item = &row->item;
+	struct timespec start;
+	struct cost before;
+	long took;
+	int res;
+
+	read_cost(&before);
+
+	if (item->kind == CHECK_TICK) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		res = sync_system(sync_it);
+		if (res == ENOERR)
+			res = check_file_table();
+		took = us_since(&start);
+	} else {
+		res = time_check(item->kind, item->act, &took);
 	}
+
+	account_check(item->kind, (item->kind == CHECK_TICK) ? NULL : item->act, res, took);
+	if (res != ENOERR)
+		row->failed++;
+
+	charge_row(row, &kinds[item->kind], &before, overhead);
+}
+
+/*
+ * Check the 'num' entries of a batched kind in 'rows' together, as the main loop
+ * does. They all share the time it takes, and the cost is charged to 'batch'.
+ */
+
+static void profile_batch(struct profile_row *rows[], int num, struct profile_row *batch,
+			  const struct cost *overhead)
+{
+	struct timespec start;
+	struct cost before;
+	int ii, kind = rows[0]->item.kind;
+
+	for (ii = 0; ii < num; ii++)
+		batch_act[ii] = rows[ii]->item.act;
+
+	read_cost(&before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	(*check_types[kind].check_batch) (batch_act, batch_res, num);
+	account_batch(kind, batch_act, batch_res, num, us_since(&start));
+	charge_row(batch, NULL, &before, overhead);
+
+	for (ii = 0; ii < num; ii++) {
+		if (batch_res[ii] != ENOERR)
+			rows[ii]->failed++;
+	}
+}
+
+static void format_count(char *buf, size_t size, unsigned long long count, long runs, int counted)
+{
+	if (counted)
+		snprintf(buf, size, "%.1f", (double)count / runs);
+	else
+		snprintf(buf, size, "-");
+}
+
+/*
+ * One line of the --profile report. The system calls are only shown if 'counted',
+ * neither they nor the forks if the cost is 'shared' with others (as for pings).
+ */
+
+static void print_profile_row(const char *name, const struct histogram *h, unsigned long long syscalls,
+			      unsigned long forks, unsigned long failed, long runs, int counted, int shared)
+{
+	char sbuf[32], fbuf[32];
+
+	format_count(sbuf, sizeof(sbuf), syscalls, runs, counted && !shared);
+	format_count(fbuf, sizeof(fbuf), forks, runs, !shared);
+	printf(profile_row_fmt, name, hist_percentile(h, 50), hist_percentile(h, 99), h->max, sbuf, fbuf, failed);
+}
+
+/*
+ * The --profile option: run every configured check 'runs' times, one after the
+ * other with the device closed and no action taken on the results, then report
+ * what each cost and whether a pass of them all fits the time allowed. Returns
+ * the exit status, non-zero if it does not fit.
+ */
+
+static int profile(const char *configfile, long runs, int sync_it)
+{
+	struct profile_row *rows, **batch, kinds[CHECK_TYPES];
+	struct timespec far, start;
+	struct cost mark, overhead;
+	char name[64], pooled[128];
+	size_t len = 0;
+	int ii, num = 1, counted, kind;
+	long run, budget;
+	unsigned long worst;
+
+	daemon_pid = getpid();
+
+	open_checks();
+	counted = (open_cost() == 0);
+
+	/* Take every check from a schedule built as the main loop's would be. */
+	for (kind = 0; kind < CHECK_TYPES; kind++)
+		num += list_count(check_entries(kind));
+
+	rows = (struct profile_row *)xcalloc(num, sizeof(struct profile_row));
+	batch = (struct profile_row **)xcalloc(num, sizeof(struct profile_row *));
+	memset(kinds, 0, sizeof(kinds));
+
+	build_schedule();
+	far.tv_sec = time_mono(NULL) + 366L * 24 * 3600 * 100;
+	far.tv_nsec = 0;
+	for (num = 0; sched_pop_due(&far, &rows[num].item); num++) {
+	}
+	sched_free();
+	alloc_batches();
+
+	/* Reading the counts has a cost of its own, which is taken off each check. */
+	read_cost(&mark);
+	read_cost(&overhead);
+	overhead.syscalls -= mark.syscalls;
+
+	for (run = 0; run < runs && _running; run++) {
+		proc_next_pass();
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (ii = 0; ii < num; ii++) {
+			if (!(check_types[rows[ii].item.kind].flags & CHECK_BATCHED))
+				profile_check(&rows[ii], kinds, sync_it, &overhead);
+		}
+
+		for (kind = 0; kind < CHECK_TYPES; kind++) {
+			int num_batch = 0;
+
+			if (!(check_types[kind].flags & CHECK_BATCHED))
+				continue;
+
+			for (ii = 0; ii < num; ii++) {
+				if (rows[ii].item.kind == kind)
+					batch[num_batch++] = &rows[ii];
+			}
+
+			if (num_batch > 0)
+				profile_batch(batch, num_batch, &kinds[kind], &overhead);
+		}
+
+		hist_add(&loop_latency, us_since(&start));
+	}
+
+	printf("profile of %s: %ld pass(es) of every check, device closed, no action taken\n", configfile, run);
+	printf("latency in usec, system calls (%s) and forks per run\n\n", cost_source());
+	printf(profile_fmt, "check", "p50", "p99", "max", "syscalls", "forks", "failed");
+
+	for (kind = 0; kind < CHECK_TYPES; kind++) {
+		const struct check_type *type = &check_types[kind];
+		int shared = (type->flags & CHECK_BATCHED) != 0;
+
+		if (type->latency.count == 0)
+			continue;
+
+		for (ii = 0; ii < num; ii++) {
+			if (rows[ii].item.kind == kind)
+				kinds[kind].failed += rows[ii].failed;
+		}
+
+		print_profile_row(type->name, &type->latency, kinds[kind].syscalls, kinds[kind].forks,
+				  kinds[kind].failed, runs, counted, FALSE);
+
+		/* The single checks have no entries of their own to show. */
+		if (type->list == NULL)
+			continue;
+
+		for (ii = 0; ii < num; ii++) {
+			if (rows[ii].item.kind == kind) {
+				snprintf(name, sizeof(name), "  %s", check_name(&rows[ii].item));
+				/* A batch shares its cost, shown for the kind above. */
+				print_profile_row(name, rows[ii].item.act->latency, rows[ii].syscalls, rows[ii].forks,
+						  rows[ii].failed, runs, counted, shared);
+			}
+		}
+	}
+
+	printf("%-36s %8lu %8lu %8lu\n", "whole pass", hist_percentile(&loop_latency, 50),
+	       hist_percentile(&loop_latency, 99), loop_latency.max);
+
+	worst = loop_latency.max / 1000;
+	budget = loop_budget();
+
+	printf("\nslowest pass took %lums with every check due at once\n", worst);
+	printf("interval of %dms: %s\n", tint * 1000, (worst < (unsigned long)tint * 1000) ? "fits" : "does NOT fit");
+	printf("watchdog-timeout - interval of %ldms: %s\n", budget, (worst < (unsigned long)budget) ? "fits" : "does NOT fit");
+
+	if (check_workers > 0) {
+		pooled[0] = '\0';
+		for (kind = 0; kind < CHECK_TYPES && len < sizeof(pooled); kind++) {
+			if (check_types[kind].flags & CHECK_POOLED)
+				len += snprintf(pooled + len, sizeof(pooled) - len, " %s", check_types[kind].name);
+		}
+		printf("(checks were run one at a time, the check-workers pool would overlap these:%s)\n", pooled);
+	}
+
+	free(batch);
+	free(rows);
+	close_cost();
+	close_checks();
+
+	return (worst < (unsigned long)tint * 1000 && worst < (unsigned long)budget) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char *const argv[])
 {
 	int c, foreground = FALSE, force = FALSE, sync_it = FALSE;
 	char *configfile = CONFIG_FILENAME;
-	struct list *act;
 	char *progname;
-	char *opts = "d:i:n:Ffsvbql:p:t:c:r:m:a:X:";
+	char *opts = "d:i:n:Ffsvbql:p:t:c:r:m:a:X:P:";
 	struct option long_options[] = {
 		{"config-file", required_argument, NULL, 'c'},
 		{"foreground", no_argument, NULL, 'F'},
@@ -390,14 +1267,16 @@ int main(int argc, char *const argv[])
 		{"verbose", no_argument, NULL, 'v'},
 		{"softboot", no_argument, NULL, 'b'},
 		{"loop-exit", required_argument, NULL, 'X'},
+		{"profile", required_argument, NULL, 'P'},
 		{NULL, 0, NULL, 0}
 	};
 	long count = 0L;
 	long count_max = 0L;
-	unsigned long swait, twait;
+	long profile_runs = 0L;
 	int softboot = FALSE;
-	struct list *memtimer = NULL;
-	struct list *loadtimer = NULL;
+	int num_batch = 0;
+	int num_jobs = 0, pooled = FALSE;
+	time_t next_latency = 0;
 
 	progname = basename(argv[0]);
 	open_logging(progname, MSG_TO_STDERR | MSG_TO_SYSLOG);
@@ -444,13 +1323,18 @@ int main(int argc, char *const argv[])
 			log_message(LOG_WARNING, "NOTE: Using --loop-exit so daemon will exit after %ld time intervals",
 				    count_max);
 			break;
+		case 'P':
+			profile_runs = atol(optarg);
+			if (profile_runs < 1)
+				usage(progname);
+			no_act = TRUE;
+			break;
 		default:
 			usage(progname);
 		}
 	}
 
-	add_list(&memtimer, "<free-memory>", 0);
-	add_list(&loadtimer, "<load-average>", 0);
+	init_checks();
 
 	read_config(configfile);
 
@@ -459,8 +1343,8 @@ int main(int argc, char *const argv[])
 		retry_timeout = 0;
 	}
 
-	if (!force) {
-		check_parameters();
+	if (!force && check_parameters()) {
+		fatal_error(EX_USAGE, "To force parameter(s) use the --force command line option.");
 	}
 
 	/* make sure we get our own log directory */
@@ -468,9 +1352,14 @@ int main(int argc, char *const argv[])
 		fatal_error(EX_SYSERR, "Cannot create directory %s (%s)", logdir, strerror(errno));
 	}
 
-	/* set up pinging if in ping mode */
-	if (target_list != NULL) {
-		open_netcheck(target_list);
+	/* Find out now, while still on the terminal, if any entry can't be checked (e.g. an unknown ping host). */
+	if (valid_checks() < 0) {
+		fatal_error(EX_USAGE, "cannot check the configured entries");
+	}
+
+	/* Only measure the checks, leaving the device and any running daemon alone. */
+	if (profile_runs > 0) {
+		exit(profile(configfile, profile_runs, sync_it));
 	}
 
 	if (!foreground) {
@@ -498,96 +1387,193 @@ int main(int argc, char *const argv[])
 		open_watchdog(devname, dev_timeout);
 	}
 
-	open_tempcheck(temp_list);
-
-	open_heartbeat();
+	log_message(LOG_INFO, "loop budget: %ldms, checks deferred after %d%%", loop_budget(), BUDGET_DEFER);
 
-	open_loadcheck();
+	open_checks();
 
-	open_memcheck();
+	open_heartbeat();
 
 	/* set signal term to set our run flag to 0 so that */
 	/* we make sure watchdog device is closed when receiving SIGTERM */
 	signal(SIGTERM, sigterm_handler);
 
+	/* SIGUSR1 asks for the latency histograms to be written out. */
+	signal(SIGUSR1, sigusr1_handler);
+
+	/* SIGHUP asks for the configuration file to be read again. */
+	signal(SIGHUP, sighup_handler);
+
 	lock_our_memory(realtime, schedprio, daemon_pid);
 
-	/* Short wait (50ms OK?) in case test binaries return quickly, then
-	 * remaining 'twait' should make watchdog sleep 'tint' seconds total.
-	 */
-	swait = 50000;
-	twait = (tint * 1000000) - swait;
+	/* Optionally refresh the device from its own thread, gated on our progress. */
+	if (ka_thread_mode) {
+		if (start_keepalive_thread((ka_stale > 0) ? ka_stale : dev_timeout, schedprio) < 0) {
+			log_message(LOG_WARNING, "keep-alive thread not started, refreshing from main loop");
+		}
+	}
+
+	/* Optionally run the independent checks side by side. */
+	if (check_workers > 0) {
+		pooled = (open_workers(check_workers) > 0);
+	}
 
-	/* main loop: update after <tint> seconds */
+	/* Set up the loop timer, and have test binaries reaped as soon as they exit. */
+	if (open_event_loop() == 0) {
+		event_watch_children(child_event);
+		watch_checks();
+	} else {
+		log_message(LOG_WARNING, "no event loop, using simple sleep between intervals");
+	}
+
+	build_schedule();
+	open_stats();
+	open_metrics(&loop_latency);
+	open_control(control_command);
+	next_latency = time_mono(NULL) + latency_interval;
+	alloc_batches();
+
+	/*
+	 * main loop: run whatever checks are due, then sleep until the next one is. The
+	 * deadlines are absolute so the time spent on the checks does not add to the
+	 * period, and any child processes or socket data are dealt with as they arrive.
+	 */
 	while (_running) {
-		wd_action(keep_alive(), repair_bin, NULL);
+		struct sched_item item;
+		struct timespec now, due, loop_start, check_start;
+		int ticked = FALSE, deferring = FALSE;
+		long loop_us;
+
+		if (reload_pending) {
+			reload_pending = FALSE;
+			reload_config(configfile, sync_it, force);
+		}
 
-		/* sync system if we have to */
-		do_check(sync_system(sync_it), repair_bin, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		loop_start = now;
 
-		/* check file table */
-		do_check(check_file_table(), repair_bin, NULL);
+		/* Refresh in good time even if no tick is due (e.g. interval too long). */
+		if (keep_alive_deadline(&due) == 0 &&
+		    (due.tv_sec < now.tv_sec || (due.tv_sec == now.tv_sec && due.tv_nsec <= now.tv_nsec))) {
+			wd_action(keep_alive(), repair_bin, NULL);
+		}
 
-		/* check load average */
-		do_check(check_load(), repair_bin, loadtimer);
+		/* The checks due now share one read of each /proc file they look at. */
+		proc_next_pass();
 
-		/* check free memory */
-		do_check(check_memory(), repair_bin, memtimer);
+		while (_running && sched_pop_due(&now, &item)) {
+			if (item.kind != CHECK_TICK && (maintenance || item.act->paused)) {
+				/* Held off from the control socket, but kept on its period. */
+				requeue_check(&item);
+				continue;
+			}
 
-		/* check allocatable memory */
-		do_check(check_allocatable(), repair_bin, memtimer);
+			if (joins_batch(&item, num_batch)) {
+				/* Collect the ping targets and run them together below. */
+				batch_items[num_batch++] = item;
+				continue;
+			}
 
-		/* check temperature */
-		for (act = temp_list; act != NULL; act = act->next)
-			do_check(check_temp(act), repair_bin, act);
+			if (pooled && independent_check(item.kind)) {
+				/* Run with the others on the worker pool below. */
+				check_jobs[num_jobs++].item = item;
+				continue;
+			}
 
-		/* in filemode stat file */
-		for (act = file_list; act != NULL; act = act->next)
-			do_check(check_file_stat_safe(act), repair_bin, act);
+			check_start = now;
 
-		/* in pidmode kill -0 processes */
-		for (act = pidfile_list; act != NULL; act = act->next)
-			do_check(check_pidfile(act), repair_bin, act);
+			if (item.kind == CHECK_TICK) {
+				ticked = TRUE;
+				wd_action(keep_alive(), repair_bin, NULL);
 
-		/* in network mode check the given devices for input */
-		for (act = iface_list; act != NULL; act = act->next)
-			do_check(check_iface(act), repair_bin, act);
+				if (!maintenance) {
+					/* sync system if we have to */
+					do_check(sync_system(sync_it), repair_bin, NULL);
 
-		/* in ping mode ping the ip address */
-		for (act = target_list; act != NULL; act = act->next)
-			do_check(check_net(act->name,
-					   act->parameter.net.sock_fp,
-					   act->parameter.net.to,
-					   act->parameter.net.packet, tint, pingcount), repair_bin, act);
+					/* check file table */
+					do_check(check_file_table(), repair_bin, NULL);
+				}
+			} else {
+				run_check(&item);
+			}
 
-		/* test, or test/repair binaries in the watchdog.d directory */
-		for (act = tr_bin_list; act != NULL; act = act->next)
-			do_check(check_bin(act->name, test_timeout, act->version), repair_bin, act);
+			requeue_check(&item);
+			clock_gettime(CLOCK_MONOTONIC, &now);
 
-		/* in case test binaries return quickly */
-		usleep(swait);
-		check_bin(NULL, test_timeout, 0);
+			/* The checks are counted by run_check(), the tick has its own results. */
+			if (item.kind == CHECK_TICK)
+				account_check(CHECK_TICK, NULL, ENOERR, us_between(&check_start, &now));
 
-		/* finally sleep for a full cycle */
-		/* we have just triggered the device with the last check */
-		usleep(twait);
+			if (charge_budget(check_name(&item), ms_between(&check_start, &now), ms_between(&loop_start, &now))) {
+				/* Anything else due stays in the schedule and is picked up next pass. */
+				if (verbose)
+					log_message(LOG_DEBUG, "loop budget nearly used after %s, deferring other checks", check_name(&item));
+				deferring = TRUE;
+				break;
+			}
+		}
+
+		/*
+		 * Pooled checks go after the rest, so a test binary being reaped here can't
+		 * collect a child process a worker is waiting on. Those already collected
+		 * wait for the next pass too if the budget is nearly used.
+		 */
+		if ((num_jobs > 0 || num_batch > 0) && (deferring || budget_spent(ms_since(&loop_start)))) {
+			defer_collected(check_jobs, num_jobs, batch_items, num_batch);
+			num_jobs = num_batch = 0;
+		} else if (pooled && (num_jobs > 0 || num_batch > 0)) {
+			run_pooled_checks(check_jobs, num_jobs, batch_items, num_batch, &loop_start);
+			num_jobs = num_batch = 0;
+		} else if (num_batch > 0) {
+			run_batch(batch_items, num_batch, &loop_start);
+			num_batch = 0;
+		}
+
+		loop_us = us_since(&loop_start);
+		hist_add(&loop_latency, loop_us);
+		update_stats(loop_us);
+
+		/* Write the latency histograms when asked with SIGUSR1, or every latency-interval. */
+		if (dump_latency || (latency_interval > 0 && time_mono(NULL) >= next_latency)) {
+			dump_latency = FALSE;
+			next_latency = time_mono(NULL) + latency_interval;
+			write_latency();
+		}
 
-		count++;
+		if (ticked) {
+			count++;
 
-		/* do verbose logging */
-		if (verbose && logtick && (--ticker == 0)) {
-			ticker = logtick;
-			log_message(LOG_DEBUG, "still alive after %ld interval(s)", count);
+			/* do verbose logging */
+			if (verbose && logtick && (--ticker == 0)) {
+				ticker = logtick;
+				log_message(LOG_DEBUG, "still alive after %ld interval(s)", count);
+				log_keep_alive_stats();
+			}
+
+			if (count_max > 0 && count >= count_max) {
+				log_message(LOG_WARNING, "loop exit on interval counter reached");
+				_running = 0;
+			}
 		}
 
-		if (count_max > 0 && count >= count_max) {
-			log_message(LOG_WARNING, "loop exit on interval counter reached");
-			_running = 0;
+		if (_running && sched_next(&due) == 0) {
+			struct timespec ka_due;
+
+			if (keep_alive_deadline(&ka_due) == 0 && (ka_due.tv_sec < due.tv_sec ||
+			    (ka_due.tv_sec == due.tv_sec && ka_due.tv_nsec < due.tv_nsec))) {
+				due = ka_due;
+			}
+
+			event_wait(&due);
 		}
 	}
 
-	free_list(&loadtimer);
-	free_list(&memtimer);
+	log_keep_alive_stats();
+	close_workers();
+	sched_free();
+	free(check_jobs);
+	free(batch_items);
+	free(batch_act);
+	free(batch_res);
 
 	terminate(EXIT_SUCCESS);
 	/* not reached */
@@ -0,0 +1,356 @@
+/* > wd_heartbeat.c
+ *
+ * Small utility to read the watchdog heartbeat file, in either the binary or
+ * the older ASCII format, and report restarts of the daemon and any gaps in the
+ * beats that are longer than expected. It can also write the beats out as a
+ * binary heartbeat file, for example to convert an ASCII one.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "extern.h"
+#include "read-conf.h"
+#include "heartbeat.h"
+
+struct beat {
+	uint64_t seq;
+	int64_t sec;
+	uint32_t nsec;
+	uint32_t generation;
+};
+
+static void usage(char *progname)
+{
+	fprintf(stderr, "%s version %d.%d, usage:\n", progname, MAJOR_VERSION, MINOR_VERSION);
+	fprintf(stderr, "%s [options] [heartbeat-file]\n", progname);
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -c | --config-file <file>  specify location of config file\n");
+	fprintf(stderr, "  -g | --gap <seconds>       report gaps longer than this (default twice the interval)\n");
+	fprintf(stderr, "  -l | --list                list every beat\n");
+	fprintf(stderr, "  -o | --output <file>       write the beats to a binary heartbeat file\n");
+	fprintf(stderr, "  -v | --verbose             verbose messages\n");
+	exit(1);
+}
+
+static int cmp_beat(const void *a, const void *b)
+{
+	const struct beat *x = (const struct beat *)a, *y = (const struct beat *)b;
+
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static double beat_diff(const struct beat *later, const struct beat *earlier)
+{
+	return (double)(later->sec - earlier->sec) + ((double)later->nsec - (double)earlier->nsec) / 1e9;
+}
+
+static const char *beat_time(const struct beat *b)
+{
+	static char buf[64];
+	time_t t = (time_t) b->sec;
+	struct tm *tm = gmtime(&t);
+
+	if (tm == NULL || strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm) == 0)
+		snprintf(buf, sizeof(buf), "%lld", (long long)b->sec);
+
+	return buf;
+}
+
+/*
+ * Read the whole of 'name' into a malloc'd buffer, returning its length in 'len'.
+ */
+
+static char *read_file(const char *name, size_t *len)
+{
+	FILE *fp;
+	struct stat st;
+	char *buf;
+
+	if ((fp = fopen(name, "r")) == NULL || fstat(fileno(fp), &st) < 0) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", name, errno, strerror(errno));
+		if (fp != NULL)
+			fclose(fp);
+		return NULL;
+	}
+
+	buf = (char *)xcalloc(st.st_size + 1, 1);
+	*len = fread(buf, 1, st.st_size, fp);
+	if (ferror(fp)) {
+		log_message(LOG_ERR, "cannot read %s (errno = %d = '%s')", name, errno, strerror(errno));
+		free(buf);
+		buf = NULL;
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+static int is_binary(const char *buf, size_t len)
+{
+	const struct hb_header *hdr = (const struct hb_header *)buf;
+
+	return len >= sizeof(struct hb_header) && hdr->magic == HB_MAGIC;
+}
+
+/*
+ * Pick the used slots out of a binary file, oldest first.
+ */
+
+static struct beat *decode_binary(const char *name, const char *buf, size_t len, int *num)
+{
+	const struct hb_header *hdr = (const struct hb_header *)buf;
+	const struct hb_slot *slots = (const struct hb_slot *)(buf + hdr->header_size);
+	struct beat *beats;
+	uint32_t ii;
+	int jj;
+
+	if (hdr->version != HB_VERSION || hdr->slot_size != sizeof(struct hb_slot) ||
+	    hdr->header_size < sizeof(struct hb_header) ||
+	    len < hdr->header_size + (size_t)hdr->nslots * hdr->slot_size) {
+		log_message(LOG_ERR, "%s: unsupported or truncated binary heartbeat file", name);
+		return NULL;
+	}
+
+	printf("%s: binary, %u slots, generation %u, %llu beats at last open/close\n",
+	       name, hdr->nslots, hdr->generation, (unsigned long long)hdr->write_index);
+	printf("boot id: ");
+	for (jj = 0; jj < 16; jj++)
+		printf("%s%02x", (jj == 4 || jj == 6 || jj == 8 || jj == 10) ? "-" : "", hdr->boot_id[jj]);
+	printf("\n");
+
+	beats = (struct beat *)xcalloc(hdr->nslots + 1, sizeof(struct beat));
+	*num = 0;
+	for (ii = 0; ii < hdr->nslots; ii++) {
+		if (slots[ii].seq == 0)
+			continue;
+		beats[*num].seq = slots[ii].seq;
+		beats[*num].sec = slots[ii].sec;
+		beats[*num].nsec = slots[ii].nsec;
+		beats[*num].generation = slots[ii].generation;
+		(*num)++;
+	}
+
+	qsort(beats, *num, sizeof(struct beat), cmp_beat);
+	return beats;
+}
+
+/*
+ * Parse the ASCII format: one time stamp per line in seconds, with a
+ * "--restart--" line each time the daemon opened the file.
+ */
+
+static struct beat *decode_ascii(const char *name, char *buf, int *num)
+{
+	struct beat *beats;
+	char *line, *save = NULL;
+	uint32_t gen = 1;
+	int size = 0;
+
+	printf("%s: ascii\n", name);
+
+	for (line = buf; *line; line++)
+		size += (*line == '\n');
+
+	beats = (struct beat *)xcalloc(size + 1, sizeof(struct beat));
+	*num = 0;
+	for (line = strtok_r(buf, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+		char *end;
+		long long sec;
+
+		line = str_start(line);
+		if (strncmp(line, "--restart--", 11) == 0) {
+			if (*num > 0)
+				gen++;
+			continue;
+		}
+
+		sec = strtoll(line, &end, 10);
+		if (end == line || *num >= size)
+			continue;
+
+		beats[*num].seq = *num + 1;
+		beats[*num].sec = sec;
+		beats[*num].generation = gen;
+		(*num)++;
+	}
+
+	return beats;
+}
+
+/*
+ * Write the newest beats to 'name' in the binary format with 'hbstamps' slots, as
+ * the daemon would have written them.
+ */
+
+static int write_binary(const char *name, const struct beat *beats, int num)
+{
+	struct hb_header hdr;
+	struct hb_slot *slots;
+	FILE *fp;
+	int ii, first = (num > hbstamps) ? num - hbstamps : 0, rv = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = HB_MAGIC;
+	hdr.version = HB_VERSION;
+	hdr.header_size = sizeof(struct hb_header);
+	hdr.slot_size = sizeof(struct hb_slot);
+	hdr.nslots = hbstamps;
+	hdr.write_index = (num > 0) ? beats[num - 1].seq : 0;
+	hdr.generation = (num > 0) ? beats[num - 1].generation : 0;
+
+	slots = (struct hb_slot *)xcalloc(hbstamps, sizeof(struct hb_slot));
+	for (ii = first; ii < num; ii++) {
+		struct hb_slot *slot = &slots[(beats[ii].seq - 1) % hbstamps];
+		slot->seq = beats[ii].seq;
+		slot->sec = beats[ii].sec;
+		slot->nsec = beats[ii].nsec;
+		slot->generation = beats[ii].generation;
+	}
+
+	if ((fp = fopen(name, "w")) == NULL) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", name, errno, strerror(errno));
+		free(slots);
+		return 1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(slots, sizeof(struct hb_slot), hbstamps, fp) != hbstamps) {
+		log_message(LOG_ERR, "write %s gave error %d = '%s'", name, errno, strerror(errno));
+		rv = 1;
+	}
+
+	if (fclose(fp) == EOF && rv == 0) {
+		log_message(LOG_ERR, "cannot close %s (errno = %d = '%s')", name, errno, strerror(errno));
+		rv = 1;
+	}
+
+	free(slots);
+	return rv;
+}
+
+int main(int argc, char *const argv[])
+{
+	char *configfile = NULL;
+	char *output = NULL;
+	char *buf, *name;
+	size_t len = 0;
+	double gap = 0.0, longest = 0.0;
+	int c, ii, num = 0, list = FALSE, ngaps = 0, nrestarts = 0, rv = 0;
+	struct beat *beats;
+	char *opts = "c:g:lo:v";
+	struct option long_options[] = {
+		{"config-file", required_argument, NULL, 'c'},
+		{"gap", required_argument, NULL, 'g'},
+		{"list", no_argument, NULL, 'l'},
+		{"output", required_argument, NULL, 'o'},
+		{"verbose", no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+	char *progname = basename(argv[0]);
+
+	open_logging(progname, MSG_TO_STDERR);
+
+	while ((c = getopt_long(argc, argv, opts, long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'c':
+			configfile = optarg;
+			break;
+		case 'g':
+			gap = atof(optarg);
+			break;
+		case 'l':
+			list = TRUE;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage(progname);
+		}
+	}
+
+	if (optind < argc - 1)
+		usage(progname);
+
+	/* The configuration gives the default file, the interval and the slot count. */
+	if (configfile != NULL || optind == argc)
+		read_config((configfile != NULL) ? configfile : CONFIG_FILENAME);
+
+	name = (optind < argc) ? argv[optind] : heartbeat;
+	if (name == NULL) {
+		printf("No heartbeat-file configured in \"%s\"\n", (configfile != NULL) ? configfile : CONFIG_FILENAME);
+		exit(1);
+	}
+
+	if (gap <= 0.0)
+		gap = 2.0 * tint;
+
+	if ((buf = read_file(name, &len)) == NULL)
+		exit(1);
+
+	if (is_binary(buf, len))
+		beats = decode_binary(name, buf, len, &num);
+	else
+		beats = decode_ascii(name, buf, &num);
+
+	if (beats == NULL)
+		exit(1);
+
+	if (num == 0) {
+		printf("no beats recorded\n");
+	} else {
+		printf("%d beats from %s", num, beat_time(&beats[0]));
+		printf(" to %s UTC\n", beat_time(&beats[num - 1]));
+	}
+
+	for (ii = 0; ii < num; ii++) {
+		if (list) {
+			printf("%10llu %6u %s.%09u\n", (unsigned long long)beats[ii].seq, beats[ii].generation,
+			       beat_time(&beats[ii]), beats[ii].nsec);
+		}
+
+		if (ii > 0) {
+			double diff = beat_diff(&beats[ii], &beats[ii - 1]);
+
+			if (diff > longest)
+				longest = diff;
+
+			if (beats[ii].generation != beats[ii - 1].generation) {
+				nrestarts++;
+				printf("restart (generation %u to %u) %.3f s after the beat at %s\n",
+				       beats[ii - 1].generation, beats[ii].generation, diff, beat_time(&beats[ii - 1]));
+			} else if (diff > gap) {
+				ngaps++;
+				printf("gap of %.3f s after the beat at %s\n", diff, beat_time(&beats[ii - 1]));
+			}
+		}
+	}
+
+	printf("%d restart(s), %d gap(s) over %.3f s, longest interval %.3f s\n", nrestarts, ngaps, gap, longest);
+
+	if (output != NULL) {
+		rv = write_binary(output, beats, num);
+		if (rv == 0)
+			printf("wrote %d beats to %s\n", (num < hbstamps) ? num : hbstamps, output);
+	}
+
+	free(beats);
+	free(buf);
+	close_logging();
+	exit(rv);
+}
@@ -49,7 +49,12 @@ static void usage(char *progname)
 	exit(1);
 }
 
-/* Dummy function for keep_alive.c use */
+/* Dummy functions for keep_alive.c use */
+int open_heartbeat(void)
+{
+	return 0;
+}
+
 int write_heartbeat(void)
 {
 	return 0;
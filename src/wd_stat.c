@@ -0,0 +1,228 @@
+/* > wd_stat.c
+ *
+ * Small utility to print the live statistics the watchdog daemon publishes in
+ * its stats-file (see stats.h). The file is only ever read, and the daemon never
+ * waits on us, so this can be run as often as wanted.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "extern.h"
+#include "read-conf.h"
+#include "timefunc.h"
+#include "stats.h"
+
+#define MAX_TRIES	1000	/* Attempts to get a consistent copy before giving up. */
+
+static void usage(char *progname)
+{
+	fprintf(stderr, "%s version %d.%d, usage:\n", progname, MAJOR_VERSION, MINOR_VERSION);
+	fprintf(stderr, "%s [options] [stats-file]\n", progname);
+	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -c | --config-file <file>  specify location of config file\n");
+	fprintf(stderr, "  -e | --errors              only list checks that are failing or have failed\n");
+	fprintf(stderr, "  -v | --verbose             verbose messages\n");
+	exit(1);
+}
+
+/*
+ * Copy the header and entries out of the mapped segment 'map' of 'size' bytes,
+ * retrying while the daemon is part way through an update. Returns the number of
+ * entries copied to the malloc'd '*ents', or -1.
+ */
+
+static int read_stats(const char *name, const void *map, size_t size, struct ws_header *hdr, struct ws_entry **ents)
+{
+	const volatile struct ws_header *live = (const volatile struct ws_header *)map;
+	const struct ws_entry *entries = (const struct ws_entry *)((const char *)map + sizeof(struct ws_header));
+	uint32_t seq;
+	size_t num;
+	int tries;
+
+	*ents = NULL;
+	for (tries = 0; tries < MAX_TRIES; tries++) {
+		seq = live->seq;
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+
+		__sync_synchronize();
+		memcpy(hdr, map, sizeof(struct ws_header));
+
+		num = hdr->nentries;
+		if (sizeof(struct ws_header) + num * sizeof(struct ws_entry) > size) {
+			log_message(LOG_ERR, "%s: truncated statistics file", name);
+			return -1;
+		}
+
+		*ents = (struct ws_entry *)xcalloc(num + 1, sizeof(struct ws_entry));
+		memcpy(*ents, entries, num * sizeof(struct ws_entry));
+
+		__sync_synchronize();
+		if (live->seq == seq)
+			return (int)num;
+
+		free(*ents);
+		*ents = NULL;
+	}
+
+	log_message(LOG_ERR, "%s: no consistent copy after %d attempts", name, MAX_TRIES);
+	return -1;
+}
+
+static void print_header(const struct ws_header *hdr)
+{
+	time_t now = time(NULL);
+	long up = (long)(now - hdr->started);
+
+	printf("watchdog pid %d%s, up %ldd %02ld:%02ld:%02ld, updated %lds ago\n", hdr->pid,
+	       (kill(hdr->pid, 0) < 0 && errno == ESRCH) ? " (not running)" : "",
+	       up / 86400, (up / 3600) % 24, (up / 60) % 60, up % 60, (long)(now - hdr->updated));
+	printf("%llu loop(s) of interval %ds, last took %.1fms, longest %.1fms\n",
+	       (unsigned long long)hdr->loops, hdr->interval, hdr->last_loop_us / 1000.0, hdr->max_loop_us / 1000.0);
+
+	if (hdr->timeout == 0) {
+		printf("no watchdog device open\n");
+	} else {
+		printf("device time-out %ds, %llu refreshes, time left %dms, least %dms%s, %llu near miss(es)\n",
+		       hdr->timeout, (unsigned long long)hdr->refreshes, hdr->last_margin_ms, hdr->min_margin_ms,
+		       hdr->hw_timeleft ? "" : " (estimated)", (unsigned long long)hdr->near_miss);
+	}
+}
+
+static void print_entry(const struct ws_entry *ent, time_t now_mono)
+{
+	char retry[16], rtt[32];
+
+	if (ent->last_time != 0)
+		snprintf(retry, sizeof(retry), "%lds", (long)(now_mono - ent->last_time));
+	else
+		snprintf(retry, sizeof(retry), "-");
+
+	if (ent->rtt_us >= 0)
+		snprintf(rtt, sizeof(rtt), "%.1f/%.1f %u/%u", ent->rtt_us / 1000.0, ent->rttvar_us / 1000.0,
+			 ent->lost, ent->sent);
+	else
+		snprintf(rtt, sizeof(rtt), "-");
+
+	printf("%-12.12s %-32.32s %7llu %7llu %9.1f %9.1f %7d %6s  %-18s %d = '%s'\n",
+	       ent->kind, ent->name, (unsigned long long)ent->checks, (unsigned long long)ent->errors,
+	       ent->last_latency_us / 1000.0, ent->max_latency_us / 1000.0, ent->repair_count, retry,
+	       rtt, ent->last_result, wd_strerror(ent->last_result));
+}
+
+int main(int argc, char *const argv[])
+{
+	char *configfile = NULL;
+	char *name;
+	int c, ii, num, errors_only = FALSE, fd;
+	struct ws_header hdr;
+	struct ws_entry *ents;
+	struct stat st;
+	void *map;
+	char *opts = "c:ev";
+	struct option long_options[] = {
+		{"config-file", required_argument, NULL, 'c'},
+		{"errors", no_argument, NULL, 'e'},
+		{"verbose", no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+	char *progname = basename(argv[0]);
+
+	open_logging(progname, MSG_TO_STDERR);
+
+	while ((c = getopt_long(argc, argv, opts, long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'c':
+			configfile = optarg;
+			break;
+		case 'e':
+			errors_only = TRUE;
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage(progname);
+		}
+	}
+
+	if (optind < argc - 1)
+		usage(progname);
+
+	if (optind < argc) {
+		name = argv[optind];
+	} else {
+		read_config((configfile != NULL) ? configfile : CONFIG_FILENAME);
+		name = stats_file;
+	}
+
+	if (name == NULL) {
+		printf("No stats-file configured in \"%s\"\n", (configfile != NULL) ? configfile : CONFIG_FILENAME);
+		exit(1);
+	}
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		log_message(LOG_ERR, "cannot open %s (errno = %d = '%s')", name, errno, strerror(errno));
+		exit(1);
+	}
+
+	if ((size_t)st.st_size < sizeof(struct ws_header)) {
+		log_message(LOG_ERR, "%s: not a watchdog statistics file", name);
+		exit(1);
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		log_message(LOG_ERR, "cannot map %s (errno = %d = '%s')", name, errno, strerror(errno));
+		exit(1);
+	}
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (hdr.magic != WS_MAGIC || hdr.version != WS_VERSION || hdr.header_size != sizeof(struct ws_header) ||
+	    hdr.entry_size != sizeof(struct ws_entry)) {
+		log_message(LOG_ERR, "%s: unsupported statistics file (version %u)", name, hdr.version);
+		exit(1);
+	}
+
+	num = read_stats(name, map, st.st_size, &hdr, &ents);
+	munmap(map, st.st_size);
+	if (num < 0)
+		exit(1);
+
+	print_header(&hdr);
+	if (verbose)
+		printf("%s: %d entries, update %u\n", name, num, hdr.seq / 2);
+
+	printf("\n%-12s %-32s %7s %7s %9s %9s %7s %6s  %-18s %s\n", "kind", "name", "checks", "errors",
+	       "last ms", "max ms", "repairs", "retry", "rtt/var ms lost", "last result");
+	for (ii = 0; ii < num; ii++) {
+		if (errors_only && ents[ii].errors == 0 && ents[ii].last_result == 0)
+			continue;
+		print_entry(&ents[ii], time_mono(NULL));
+	}
+
+	free(ents);
+	close_logging();
+	exit(0);
+}
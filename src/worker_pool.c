@@ -0,0 +1,175 @@
+/* > worker_pool.c
+ *
+ * Small fixed-size pool of threads for running independent checks at the same
+ * time, so a main loop iteration costs about as long as its slowest check
+ * rather than the sum of all of them. The main thread queues a batch of jobs
+ * then waits for them all to finish before acting on the results, so the
+ * repair and shut-down decisions are still taken one at a time.
+ *
+ * Jobs must only touch their own data (or data protected by a lock) as any
+ * number of them may be running together.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "extern.h"
+#include "watch_err.h"
+
+#define MAX_WORKERS	16
+
+struct work {
+	work_func func;
+	void *ptr;
+};
+
+static pthread_t workers[MAX_WORKERS];
+static int num_workers = 0;
+
+/*
+ * The queue is an array filled by workers_submit() and taken from the front by
+ * the workers. 'pending' counts jobs queued or still running, the main thread
+ * waits on 'done' for it to reach zero.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct work *queue = NULL;
+static int queue_size = 0;
+static int queue_len = 0;
+static int queue_next = 0;
+static int pending = 0;
+static int stopping = FALSE;
+
+static void *worker_thread(void *arg)
+{
+	pthread_mutex_lock(&pool_lock);
+
+	while (!stopping) {
+		if (queue_next < queue_len) {
+			struct work job = queue[queue_next++];
+
+			pthread_mutex_unlock(&pool_lock);
+			(*job.func) (job.ptr);
+			pthread_mutex_lock(&pool_lock);
+
+			if (--pending == 0)
+				pthread_cond_signal(&pool_done);
+		} else {
+			pthread_cond_wait(&pool_work, &pool_lock);
+		}
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+/*
+ * Start 'num' worker threads. Returns the number started, with 0 meaning there is
+ * no pool and the caller should run its checks itself.
+ */
+
+int open_workers(int num)
+{
+	close_workers();
+
+	if (num > MAX_WORKERS)
+		num = MAX_WORKERS;
+
+	stopping = FALSE;
+	for (num_workers = 0; num_workers < num; num_workers++) {
+		int err = pthread_create(&workers[num_workers], NULL, worker_thread, NULL);
+		if (err) {
+			log_message(LOG_ERR, "cannot start check worker (errno = %d = '%s')", err, strerror(err));
+			break;
+		}
+	}
+
+	if (num_workers > 0)
+		log_message(LOG_INFO, "started %d check worker thread(s)", num_workers);
+
+	return num_workers;
+}
+
+/*
+ * Queue 'func' to be called with 'ptr' by one of the workers. Without a pool it
+ * is simply called now.
+ */
+
+void workers_submit(work_func func, void *ptr)
+{
+	if (num_workers == 0) {
+		(*func) (ptr);
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+
+	if (queue_len >= queue_size) {
+		queue_size += 16;
+		queue = (struct work *)realloc(queue, queue_size * sizeof(struct work));
+		if (queue == NULL) {
+			fatal_error(EX_SYSERR, "out of memory for check workers");
+		}
+	}
+
+	queue[queue_len].func = func;
+	queue[queue_len].ptr = ptr;
+	queue_len++;
+	pending++;
+
+	pthread_cond_signal(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Wait for every job queued so far to finish.
+ */
+
+void workers_wait(void)
+{
+	if (num_workers == 0)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	while (pending > 0)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	queue_len = queue_next = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Stop the workers, waiting for any queued jobs to finish first.
+ */
+
+int close_workers(void)
+{
+	int ii;
+
+	if (num_workers == 0)
+		return -1;
+
+	workers_wait();
+
+	pthread_mutex_lock(&pool_lock);
+	stopping = TRUE;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+
+	for (ii = 0; ii < num_workers; ii++)
+		pthread_join(workers[ii], NULL);
+
+	num_workers = 0;
+	free(queue);
+	queue = NULL;
+	queue_size = 0;
+
+	return 0;
+}